@@ -43,6 +43,55 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
+int jobject_decode(struct jhandle * const jhandle, char *ptr, bsize_t len);
+int jobject_reserve(struct jhandle * const jhandle, joff_t count);
+void jobject_rewind(struct jhandle * const jhandle, joff_t used);
+int jobject_shrink(struct jhandle * const jhandle);
+char *jstring_allocate(struct jhandle * const jhandle, bsize_t len);
+void jstring_release(struct jhandle * const jhandle, boff_t offset, 
+		     bsize_t len);
+void jobject_release(struct jhandle * const jhandle, 
+		     struct jobject *jobject);
+static void *jobject_malloc(struct jhandle * const jhandle, size_t size);
+static void *jobject_realloc(struct jhandle * const jhandle, void *ptr, 
+			     size_t oldsize, size_t size);
+static void jobject_free(struct jhandle * const jhandle, void *ptr, 
+			 size_t size);
+#ifdef AMJSON_SLABPOOL
+static int jobject_grow(struct jhandle * const jhandle, joff_t count);
+#endif
+void jobject_modified(struct jhandle * const jhandle, struct jobject *jobject);
+struct jspan *jspan_find(struct jhandle * const jhandle, struct jobject *jobject);
+uint32_t jindex_keyhash(char *ptr, jsize_t len);
+struct jindex *jindex_find(struct jhandle * const jhandle, 
+			   struct jobject *container, joff_t uses);
+void jindex_clear(struct jhandle * const jhandle);
+static void jpath_clear(struct jhandle * const jhandle);
+static joff_t jindex_hash(joff_t node);
+static int jindex_grow(struct jhandle * const jhandle);
+static void jindex_remove(struct jhandle * const jhandle, joff_t node);
+static void jindex_truncate(struct jhandle * const jhandle, joff_t used);
+static void jindex_forget_key(struct jhandle * const jhandle, 
+			      struct jobject *key);
+
+static void jobject_discard(struct jhandle * const jhandle, 
+			    struct jobject *jobject);
+static void jobject_release_list(struct jhandle * const jhandle, 
+				 joff_t offset);
+static void jspan_record(struct jhandle * const jhandle, joff_t first, 
+			 boff_t start, boff_t end);
+static void jspan_close(struct jhandle * const jhandle);
+static void jspan_purge(struct jhandle * const jhandle);
+static joff_t jspan_search(struct jhandle * const jhandle, joff_t node);
+static struct jspan *jspan_at(struct jhandle * const jhandle, joff_t node);
+static struct jspan *jspan_enclosing(struct jhandle * const jhandle, 
+				     joff_t node);
+static int jspan_follow(struct jhandle * const jhandle, struct jspan *span,
+			boff_t end, boff_t delta);
+static void jobject_shift(struct jhandle * const jhandle, 
+			  struct jobject *jobject, struct jobject *skip,
+			  boff_t end, boff_t delta);
+
 static void amjson_element(struct jhandle * const jhandle, char **optr);
 static void amjson_object(struct jhandle * const jhandle, char **optr);
 static void amjson_array(struct jhandle * const jhandle, char **optr);
@@ -59,179 +108,1875 @@ static void amjson_null(struct jhandle * const jhandle, char **optr);
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
-/*  hexdigit is one of:    '0'-'9'  48-57
-                           'A'-'Z'  65-90  
-                           'a'-'z'  97-122
-*/
-static unsigned char const hexdigit[] = {
+/*  hexdigit is one of:    '0'-'9'  48-57
+                           'A'-'Z'  65-90  
+                           'a'-'z'  97-122
+*/
+static unsigned char const hexdigit[] = {
+
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,
+  0,1,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,1,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+
+/* escaped is one of: '"', '\\', '/', 'b', 'f', 'n', 'r', 't'
+*/
+static unsigned char const escaped[] = {
+
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,
+  0,0,1,0,0,0,1,0,0,0,0,0,0,0,1,0,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+  
+/* whitespace is one of: '\t'  9
+                         '\n' 10
+                         '\r' 13
+                         ' '  32
+*/
+static unsigned char const whitespace[] = {
+
+  0,0,0,0,0,0,0,0,0,1,1,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+
+/* token is one of:  '"'                   1 ( string )
+                    '{' '['               2 ( container )
+                    '-' '0'-'9' 't' 'f' 'n' 3 ( number or literal )
+                    '+' '.' 'E' 'a'-'z'   4 ( rest of a number or literal )
+*/
+static unsigned char const token[] = {
+
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,1,0,0,0,0,0,0,0,0,4,0,3,4,0,3,3,3,3,3,3,3,3,3,3,0,0,0,0,0,0,
+  0,0,0,0,0,4,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,0,0,0,0,
+  0,4,4,4,4,4,3,4,4,4,4,4,4,4,3,4,4,4,4,4,3,4,4,4,4,4,4,2,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+
+#define JTEXT_ALIGN 8             /* Text is handed out in multiples of 
+				   * this so released text can be reused
+				   * without being split */
+
+#define CONSUME_WHITESPACE(ptr, eptr)                       \
+                                                            \
+  do {							    \
+    for (;;) {                                              \
+      if (AM_UNLIKELY((ptr) == (eptr))) break;		    \
+      if (!whitespace[(unsigned char)(*(ptr))]) break;      \
+      ptr++;                                                \
+    }                                                       \
+  } while (0)
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_alloc(struct jhandle * const jhandle, struct jobject *ptr,
+		 joff_t count) {
+
+  return amjson_alloc_ex(jhandle, ptr, count, (struct jallocator *)0);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_alloc_ex(struct jhandle * const jhandle, struct jobject *ptr,
+		    joff_t count, struct jallocator *allocator) {
+
+  memset(jhandle, 0, sizeof(struct jhandle));
+  
+  jhandle->allocator = allocator;
+  jhandle->count     = count;
+  jhandle->root  = AMJSON_INVALID;
+
+#ifdef AMJSON_SLABPOOL
+  if (ptr) {
+
+    /* A user supplied pool is a single slab that can never grow */
+    jhandle->shift = 0;
+    while ((jhandle->shift < 31) && 
+	   (((joff_t)1 << jhandle->shift) < count)) {
+      jhandle->shift++;
+    }
+    if (((joff_t)1 << jhandle->shift) < count) {
+      jhandle->count = (joff_t)1 << jhandle->shift;
+    }
+
+    jhandle->mask       = (joff_t)((1UL << jhandle->shift) - 1);
+    jhandle->userbuffer = (unsigned int)1;
+    jhandle->jobject    = ptr;
+    jhandle->slab       = &jhandle->jobject;
+    jhandle->nslab      = 1;
+    jhandle->slabcount  = 1;
+    return 0;
+  }
+
+  if (count == 0) goto error;
+
+  /* Size slabs from the initial count so a pool that is sized well up 
+   * front has few slabs, and one that is not grows in small steps.
+   */
+  jhandle->shift = AMJSON_SLABMIN;
+  while ((jhandle->shift < AMJSON_SLABMAX) &&
+	 (((joff_t)1 << jhandle->shift) < count)) {
+    jhandle->shift++;
+  }
+  jhandle->mask  = (joff_t)((1UL << jhandle->shift) - 1);
+  jhandle->count = 0;
+
+  if (jobject_grow(jhandle, count) == 0) {
+    jhandle->jobject = jhandle->slab[0];
+    return 0;
+  }
+  amjson_free(jhandle);
+#else
+  if (ptr) {
+    jhandle->userbuffer = (unsigned int)1;
+    jhandle->jobject    = ptr;
+    return 0;
+  }
+
+  if (count == 0) goto error;
+  if ((jhandle->jobject = (struct jobject *)jobject_malloc(jhandle, 
+		     (size_t)jhandle->count * sizeof(struct jobject)))) {
+    return 0;
+  }
+#endif
+
+ error:
+  errno = EINVAL;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_free(struct jhandle *jhandle) {
+
+#ifdef AMJSON_SLABPOOL
+  if (!jhandle->userbuffer) {
+
+    size_t size = ((size_t)jhandle->mask + 1) * sizeof(struct jobject);
+    joff_t i;
+
+    for (i=0; i<jhandle->nslab; i++) {
+      if ((i == 0) && (jhandle->holeend)) {
+	jobject_free(jhandle, jhandle->slab[i], 
+		     (size_t)jhandle->holestart * sizeof(struct jobject));
+      } else {
+	jobject_free(jhandle, jhandle->slab[i], size);
+      }
+    }
+    jobject_free(jhandle, jhandle->slab, 
+		 (size_t)jhandle->slabcount * sizeof(struct jobject *));
+  }
+  jhandle->slab    = (struct jobject **)0;
+  jhandle->nslab   = 0;
+  jhandle->jobject = (struct jobject *)0;
+#else
+  if (!jhandle->userbuffer) {
+    jobject_free(jhandle, jhandle->jobject, 
+		 (size_t)jhandle->count * sizeof(struct jobject));
+  }
+#endif
+
+  free(jhandle->span);
+  jhandle->span      = (struct jspan *)0;
+  jhandle->nspan     = 0;
+  jhandle->spancount = 0;
+  jhandle->deadspans = 0;
+  jhandle->spanopen  = 0;
+
+  jobject_free(jhandle, jhandle->text, jhandle->textsize);
+  jhandle->text       = (char *)0;
+  jhandle->textused   = 0;
+  jhandle->textsize   = 0;
+  jhandle->textshared = 0;
+
+  free(jhandle->textfree);
+  jhandle->textfree      = (struct jtext *)0;
+  jhandle->ntextfree     = 0;
+  jhandle->textfreecount = 0;
+
+  jhandle->freelist = AMJSON_INVALID;
+  jhandle->nfree    = 0;
+  jhandle->built    = 0;
+
+  jindex_clear(jhandle);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_reset(struct jhandle *jhandle) {
+
+  /* Forget the DOM but keep the pool, and any span array, at the size 
+   * they have grown to.
+   */
+  jhandle->buf   = (char *)0;
+  jhandle->eptr  = (char *)0;
+  jhandle->len   = 0;
+  jhandle->used  = 0;
+  jhandle->root  = AMJSON_INVALID;
+  jhandle->depth = 0;
+  jhandle->nspan = 0;
+
+  jhandle->deadspans = 0;
+  jhandle->spanopen  = 0;
+
+  jhandle->textused   = 0;
+  jhandle->textshared = 0;
+  jhandle->ntextfree  = 0;
+  jhandle->nfree      = 0;
+  jhandle->built      = 0;
+
+  jindex_clear(jhandle);
+
+#ifdef AMJSON_SLABPOOL
+  if (jhandle->holeend) {
+
+    /* Nothing refers to slab 0 any more so it can be whole again */
+    void *ptr = jobject_realloc(jhandle, jhandle->slab[0], 
+		(size_t)jhandle->holestart * sizeof(struct jobject),
+		((size_t)jhandle->mask + 1) * sizeof(struct jobject));
+    if (ptr) {
+      jhandle->slab[0]   = (struct jobject *)ptr;
+      jhandle->jobject   = (struct jobject *)ptr;
+      jhandle->holestart = 0;
+      jhandle->holeend   = 0;
+      if (jhandle->nslab == 1) jhandle->count = jhandle->mask + 1;
+    }
+  }
+#endif
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_decode(struct jhandle * const jhandle, char *buf, bsize_t len) {
+
+  jhandle->buf = buf;
+  jhandle->len = len;
+
+  return jobject_decode(jhandle, buf, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+joff_t amjson_count(char *buf, bsize_t len) {
+
+  /* Every string, number, literal, object and array becomes exactly one
+   * jobject so counting where each of them starts is enough, nothing is
+   * validated. Strings are skipped with memchr() as they are usually 
+   * the bulk of a document.
+   */
+  char *ptr = buf;
+  char * const eptr = &buf[len];
+  size_t count = 0;
+
+  while (ptr < eptr) {
+
+    switch (token[(unsigned char)(*ptr)]) {
+
+    case 1:
+      count++;
+      for (;;) {
+
+	char *qptr = memchr(ptr+1, '"', eptr - (ptr+1));
+	char *bptr;
+
+	if (!qptr) {
+	  ptr = eptr;
+	  break;
+	}
+
+	/* An odd number of backslashes escapes the quote */
+	for (bptr = qptr; (bptr > ptr+1) && (bptr[-1] == '\\'); bptr--);
+	ptr = qptr;
+	if (((qptr - bptr) & 1) == 0) break;
+      }
+      ptr++;
+      break;
+
+    case 2:
+      count++;
+      ptr++;
+      break;
+
+    case 3:
+      count++;
+      do {
+	ptr++;
+      } while ((ptr < eptr) && (token[(unsigned char)(*ptr)] >= 3));
+      break;
+
+    default:
+      ptr++;
+      break;
+    }
+  }
+
+  return (count > JOFF_MAX)?JOFF_MAX:(joff_t)count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int jobject_decode(struct jhandle * const jhandle, char *ptr, bsize_t len) {
+
+  /* Decode a single JSON document that lives at ptr inside the JSON
+   * buffer already attached to jhandle. String offsets are generated
+   * relative to jhandle->buf, so many documents that share one buffer
+   * can be appended to the same jobject pool. A failed decode leaves 
+   * the pool as it found it.
+   */
+  joff_t used = jhandle->used;
+
+  jhandle->eptr      = &ptr[len];
+  jhandle->max_depth = AMJSON_MAXDEPTH;
+  jhandle->depth     = 0;
+  jhandle->useljmp   = 1;
+
+  switch (setjmp(jhandle->setjmp_ctx)) {
+
+  case 1:
+    /* We returned from calling amjson_element() with an 
+     * allocation failure.
+     */
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
+    errno = ENOMEM;
+    return -1;
+
+  case 2:
+
+    /* We returned from calling amjson_element() with an 
+     * parser failure.
+     */
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
+    errno = EINVAL;
+    return -1;
+  }
+  
+  amjson_element(jhandle, &ptr);
+
+  /* Once we return there is no setjmp context to jump back to, any 
+   * further allocations must report failure to their caller.
+   */
+  jhandle->useljmp = 0;
+  jspan_close(jhandle);
+
+  /* Our root object can be almost anything.
+   * The only guarentee we have is that it is something
+   * other than whitespace.
+   */
+  jhandle->root = jhandle->used - 1;
+  
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_decode_stream(struct jhandle * const jhandle, char *buf, 
+			 bsize_t len, amjson_stream_fn fn, void *arg) {
+
+  char *ptr = buf;
+  char * const eptr = &buf[len];
+  joff_t used;
+
+  /* Look past any BOM and whitespace for the opening '[', anything 
+   * else is decoded as a whole and handed to fn as a single element.
+   */
+  if (((eptr - ptr) >= 3) &&
+      ((ptr[0] == ((char)(0xEF))) &&
+       (ptr[1] == ((char)(0xBB))) && 
+       (ptr[2] == ((char)(0xBF))))) {
+	
+	ptr += 3;
+  } 
+  CONSUME_WHITESPACE(ptr, eptr);
+
+  used = jhandle->used;
+
+  /* Released just as an element of an array would be */
+  if ((eptr == ptr) || (*ptr != '[')) {
+
+    int status;
+
+    if (amjson_decode(jhandle, buf, len) != 0) return -1;
+
+    status = fn(jhandle, JOBJECT_ROOT(jhandle), arg);
+    jobject_rewind(jhandle, used);
+    if (status != 0) goto cancel;
+
+    jhandle->root = AMJSON_INVALID;
+    return 0;
+  }
+
+  jhandle->buf       = buf;
+  jhandle->len       = len;
+  jhandle->eptr      = eptr;
+  jhandle->max_depth = AMJSON_MAXDEPTH;
+  jhandle->useljmp   = 1;
+
+  switch (setjmp(jhandle->setjmp_ctx)) {
+
+  case 1:
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
+    errno = ENOMEM;
+    return -1;
+
+  case 2:
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
+    errno = EINVAL;
+    return -1;
+  }
+
+  ptr++;
+  CONSUME_WHITESPACE(ptr, eptr);
+
+  if (AM_UNLIKELY(eptr == ptr)) goto fail;  
+  if (*ptr == ']') {
+    ptr++;
+    goto success;
+  }
+
+  for (;;) {
+
+    /* Each element is decoded on its own into the pool and the pool is
+     * rewound once fn has seen it, so the pool only ever needs to be 
+     * as large as the largest element.
+     */
+    jhandle->depth = 1;
+    amjson_value(jhandle, &ptr);
+    jspan_close(jhandle);
+
+    jhandle->root    = jhandle->used - 1;
+    jhandle->useljmp = 0;
+    if (fn(jhandle, JOBJECT_ROOT(jhandle), arg) != 0) {
+      jobject_rewind(jhandle, used);
+      goto cancel;
+    }
+    jhandle->useljmp = 1;
+    jobject_rewind(jhandle, used);
+
+    if (AM_UNLIKELY(eptr == ptr)) goto fail;  
+    if (*ptr == ']') {
+      ptr++;
+      goto success;
+    } else if (*ptr != ',') {
+      goto fail;
+    }
+    ptr++;
+  }
+
+ success:
+  CONSUME_WHITESPACE(ptr, eptr);
+  if (eptr != ptr) goto fail;
+
+  jhandle->useljmp = 0;
+  jhandle->root    = AMJSON_INVALID;
+  return 0;
+
+ fail:
+  longjmp(jhandle->setjmp_ctx, 2); /* jump back with EINVAL */
+
+ cancel:
+  jhandle->root = AMJSON_INVALID;
+  errno = ECANCELED;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *jobject_malloc(struct jhandle * const jhandle, size_t size) {
+
+  /* All memory for the jobject pool comes through these three, spans 
+   * are bookkeeping and always use malloc()
+   */
+  if (jhandle->allocator) {
+    return jhandle->allocator->alloc(jhandle->allocator->ctx, size);
+  }
+  return malloc(size);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *jobject_realloc(struct jhandle * const jhandle, void *ptr, 
+			     size_t oldsize, size_t size) {
+
+  if (jhandle->allocator) {
+    return jhandle->allocator->resize(jhandle->allocator->ctx, ptr, 
+				      oldsize, size);
+  }
+  return realloc(ptr, size);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jobject_free(struct jhandle * const jhandle, void *ptr, 
+			 size_t size) {
+
+  if (!ptr) return;
+
+  if (jhandle->allocator) {
+    jhandle->allocator->release(jhandle->allocator->ctx, ptr, size);
+    return;
+  }
+  free(ptr);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *jobject_allocate(struct jhandle * const jhandle, joff_t count) {
+
+  joff_t offset = jhandle->used;
+  joff_t used;
+
+  /* Jobjects released by the modification functions are handed out 
+   * again, but never while decoding as the parser relies on the pool
+   * being filled in order.
+   */
+  if (AM_UNLIKELY(jhandle->nfree) && (count == 1) && (!jhandle->useljmp)) {
+
+    struct jobject *jobject = JOBJECT_AT(jhandle, jhandle->freelist);
+
+    jhandle->freelist = jobject->next;
+    jhandle->nfree--;
+    return jobject;
+  }
+
+#ifdef AMJSON_SLABPOOL
+  /* A run of jobjects must not straddle two slabs, any space left at the
+   * end of the current slab is skipped.
+   */
+  if (AM_UNLIKELY((joff_t)(count - 1) > jhandle->mask)) goto error;
+  if (AM_UNLIKELY(((offset & jhandle->mask) + (count - 1)) > jhandle->mask)) {
+    offset = (offset | jhandle->mask) + 1;
+    if (AM_UNLIKELY(offset == 0)) goto error; /* overflow */
+  }
+  if (AM_UNLIKELY(offset < jhandle->holeend)) {
+    if ((offset + count) > jhandle->holestart) offset = jhandle->holeend;
+  }
+#endif
+
+  used = offset + count;
+
+  if (AM_UNLIKELY(used <= offset)) goto error; /* overflow */
+  if (AM_LIKELY(used <= jhandle->count)) {
+
+    struct jobject *jobject = JOBJECT_AT(jhandle, offset);
+    jhandle->used = used;
+    
+    return jobject;
+  }
+
+  if (!jhandle->userbuffer) {
+
+#ifdef AMJSON_SLABPOOL
+    if (jobject_grow(jhandle, used) == 0) {
+      return jobject_allocate(jhandle, count);
+    }
+#else    
+    void *ptr;
+    joff_t ncount = (jhandle->count * 2) + count;
+    
+    if (AM_UNLIKELY(ncount <= jhandle->count)) goto error; /* overflow */
+
+    ptr = jobject_realloc(jhandle, jhandle->jobject, 
+			  (size_t)jhandle->count * sizeof(struct jobject),
+			  (size_t)ncount * sizeof(struct jobject));
+    if (ptr) {
+      jhandle->count   = ncount;
+      jhandle->jobject = (struct jobject *)ptr;
+      return jobject_allocate(jhandle, count);
+    }
+#endif
+  }
+
+ error:
+  if (jhandle->useljmp) {
+    /* The allocator is being used from with amjson_decode() 
+     * it's safe to jump right back to amjson_decode() 
+     */   
+    longjmp(jhandle->setjmp_ctx, 1);  /* jump back to amjson_decode() with ENOMEM */
+  }
+    
+  return (struct jobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+char *jstring_allocate(struct jhandle * const jhandle, bsize_t len) {
+
+  /* Constructed strings and numbers are kept apart from the jobjects so
+   * walking the DOM only touches jobjects. The arena may move when it
+   * grows, text is always addressed by its offset.
+   */
+  bsize_t used;
+  char *ptr;
+  joff_t i;
+
+  if (((len + JTEXT_ALIGN - 1) & ~(bsize_t)(JTEXT_ALIGN - 1)) < len) {
+    goto error; /* overflow */
+  }
+  len = (len + JTEXT_ALIGN - 1) & ~(bsize_t)(JTEXT_ALIGN - 1);
+
+  /* Released text of exactly the same size is reused first */
+  for (i=0; (len) && (i<jhandle->ntextfree); i++) {
+    if (jhandle->textfree[i].len == len) {
+      ptr = &jhandle->text[jhandle->textfree[i].offset];
+      jhandle->textfree[i] = jhandle->textfree[--jhandle->ntextfree];
+      return ptr;
+    }
+  }
+
+  used = jhandle->textused + len;
+  if (used < jhandle->textused) goto error; /* overflow */
+
+  /* Text is addressed by a boff_t, its last character must be too */
+  if ((len) && ((used - 1) > BOFF_MAX)) goto error;
+
+  if ((used > jhandle->textsize) || (!jhandle->text)) {
+
+    bsize_t size = jhandle->textsize * 2;
+
+    if (size < used) size = used;
+    if (size == 0) size = 1;
+
+    ptr = (char *)jobject_realloc(jhandle, jhandle->text, 
+				  jhandle->textsize, size);
+    if (!ptr) goto error;
+
+    jhandle->text     = ptr;
+    jhandle->textsize = size;
+  }
+
+  ptr = &jhandle->text[jhandle->textused];
+  jhandle->textused = used;
+  return ptr;
+
+ error:
+  errno = ENOMEM;
+  return (char *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void jstring_release(struct jhandle * const jhandle, boff_t offset, 
+		     bsize_t len) {
+
+  /* Text at the end of the arena is simply given back, anything else is
+   * remembered for jstring_allocate() to reuse. Text that may be shared
+   * with other jobjects, such as interned keys, is never released.
+   */
+  len = (len + JTEXT_ALIGN - 1) & ~(bsize_t)(JTEXT_ALIGN - 1);
+  if ((len == 0) || (offset < jhandle->textshared)) return;
+
+  if ((offset + len) == jhandle->textused) {
+    jhandle->textused = offset;
+    return;
+  }
+
+  if (jhandle->ntextfree == jhandle->textfreecount) {
+
+    void *ptr;
+    joff_t ncount = (jhandle->textfreecount == 0)?16:
+      (jhandle->textfreecount * 2);
+
+    if (ncount <= jhandle->textfreecount) return; /* overflow */
+
+    ptr = realloc(jhandle->textfree, (ncount * sizeof(struct jtext)));
+    if (!ptr) return;   /* the text is just not reused */
+
+    jhandle->textfreecount = ncount;
+    jhandle->textfree      = (struct jtext *)ptr;
+  }
+
+  jhandle->textfree[jhandle->ntextfree].offset = offset;
+  jhandle->textfree[jhandle->ntextfree].len    = len;
+  jhandle->ntextfree++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void jobject_release(struct jhandle * const jhandle, 
+		     struct jobject *jobject) {
+
+  /* Put a single jobject on the free list along with any text it owns.
+   * Offset 0 can not be linked to as it reads as AMJSON_INVALID, so it 
+   * is never reused.
+   */
+  joff_t offset = JOBJECT_OFFSET(jhandle, jobject);
+
+  if (jhandle->built == offset + 1) jhandle->built = 0;
+  jobject_discard(jhandle, jobject);
+
+  if (offset == 0) {
+    jobject->next = AMJSON_INVALID;
+    return;
+  }
+
+  jobject->next     = jhandle->freelist;
+  jhandle->freelist = offset;
+  jhandle->nfree++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jobject_discard(struct jhandle * const jhandle, 
+			    struct jobject *jobject) {
+
+  /* Forget whatever a jobject held, leaving an empty object in its slot.
+   * The slot may come back as a different container so its index entry
+   * and span go too.
+   */
+  unsigned int type = jobject->blen >> AMJSON_LENBITS;
+
+  if (((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) &&
+      (jobject->blen & AMJSON_STRBUFMASK)) {
+    jstring_release(jhandle, jobject->u.string.offset, 
+		    JOBJECT_STRING_LEN(jobject));
+  }
+
+  if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) && 
+      ((jhandle->nindex) || (jhandle->nspan))) {
+
+    joff_t offset = JOBJECT_OFFSET(jhandle, jobject);
+    struct jspan *span;
+
+    if (jhandle->nindex) jindex_remove(jhandle, offset);
+
+    if ((jhandle->nspan) && (span = jspan_at(jhandle, offset))) {
+      span->end = 0;
+      jhandle->deadspans++;
+    }
+  }
+
+  /* An empty object holds no text should the pool be walked */
+  jobject->blen           = AMJSON_OBJECT << AMJSON_LENBITS;
+  jobject->u.object.child = AMJSON_INVALID;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jobject_release_list(struct jhandle * const jhandle, 
+				 joff_t offset) {
+
+  /* Release a list of jobjects and everything they contain */
+  for (;;) {
+
+    struct jobject *jobject = JOBJECT_AT(jhandle, offset);
+    unsigned int type = jobject->blen >> AMJSON_LENBITS;
+    joff_t next = jobject->next;
+
+    if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+	(OBJECT_COUNT(jobject))) {
+      jobject_release_list(jhandle, jobject->u.object.child);
+    }
+    jobject_release(jhandle, jobject);
+
+    if (next == AMJSON_INVALID) break;
+    offset = next;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int jobject_reserve(struct jhandle * const jhandle, joff_t count) {
+
+  /* Make sure that count jobjects can be allocated without the pool
+   * being reallocated, this lets callers that know how much they are
+   * about to decode grow the pool once rather than many times.
+   */
+  joff_t ncount = jhandle->used + count;
+
+  if (ncount < jhandle->used) goto error; /* overflow */
+  if (ncount <= jhandle->count) return 0;
+  if (jhandle->userbuffer) goto error;
+
+#ifdef AMJSON_SLABPOOL
+  return jobject_grow(jhandle, ncount);
+#else
+  {
+    void *ptr = jobject_realloc(jhandle, jhandle->jobject, 
+				(size_t)jhandle->count * sizeof(struct jobject),
+				(size_t)ncount * sizeof(struct jobject));
+
+    if (ptr) {
+      jhandle->count   = ncount;
+      jhandle->jobject = (struct jobject *)ptr;
+      return 0;
+    }
+  }
+#endif
+
+ error:
+  errno = ENOMEM;
+  return -1;
+}
+
+#ifdef AMJSON_SLABPOOL
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int jobject_grow(struct jhandle * const jhandle, joff_t count) {
+
+  /* Add slabs until the pool holds at least count jobjects, existing
+   * slabs are left where they are.
+   */
+  size_t size = (size_t)jhandle->mask + 1;
+
+  while (jhandle->count < count) {
+
+    struct jobject *slab;
+    size_t ncount;
+
+    if (jhandle->count == JOFF_MAX) goto error;
+
+    if (jhandle->nslab == jhandle->slabcount) {
+
+      void *ptr;
+      joff_t nslab = (jhandle->slabcount == 0)?8:(jhandle->slabcount * 2);
+
+      ptr = jobject_realloc(jhandle, jhandle->slab, 
+		    (size_t)jhandle->slabcount * sizeof(struct jobject *),
+		    (size_t)nslab * sizeof(struct jobject *));
+      if (!ptr) goto error;
+
+      jhandle->slab      = (struct jobject **)ptr;
+      jhandle->slabcount = nslab;
+    }
+
+    slab = (struct jobject *)jobject_malloc(jhandle, 
+					    size * sizeof(struct jobject));
+    if (!slab) goto error;
+    
+    jhandle->slab[jhandle->nslab++] = slab;
+
+    ncount = (size_t)jhandle->nslab * size;
+    jhandle->count = (ncount > JOFF_MAX)?JOFF_MAX:(joff_t)ncount;
+  }
+
+  return 0;
+
+ error:
+  errno = ENOMEM;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+joff_t jobject_offset(struct jhandle *jhandle, struct jobject *jobject) {
+
+  /* Slabs are not ordered in memory so each one is checked in turn, 
+   * starting with the slab that matched last time as lookups tend to 
+   * be close together.
+   */
+  size_t size = (size_t)jhandle->mask + 1;
+  joff_t i = jhandle->slabhint;
+
+  if (i < jhandle->nslab) {
+
+    struct jobject *slab = jhandle->slab[i];
+    size_t len = ((i == 0) && (jhandle->holeend))?jhandle->holestart:size;
+
+    if ((jobject >= slab) && (jobject < &slab[len])) {
+      return (i << jhandle->shift) | (joff_t)(jobject - slab);
+    }
+  }
+
+  for (i=0; i<jhandle->nslab; i++) {
+
+    struct jobject *slab = jhandle->slab[i];
+    size_t len = ((i == 0) && (jhandle->holeend))?jhandle->holestart:size;
+
+    if ((jobject >= slab) && (jobject < &slab[len])) {
+      if (!jhandle->shared) jhandle->slabhint = i;
+      return (i << jhandle->shift) | (joff_t)(jobject - slab);
+    }
+  }
+
+  return AMJSON_INVALID;
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int jobject_shrink(struct jhandle * const jhandle) {
+
+  /* Give the unused end of the pool back to the allocator. With slabs 
+   * this is only done for a pool of a single slab, the released part of
+   * it becomes a hole that jobject_allocate() steps over should the 
+   * pool grow again, so slab 0 never moves.
+   */
+  void *ptr;
+
+  if ((jhandle->userbuffer) || (jhandle->used == 0)) return 0;
+
+#ifdef AMJSON_SLABPOOL
+  if ((jhandle->nslab != 1) || (jhandle->holeend)) return 0;
+  if (jhandle->used > jhandle->mask) return 0;
+
+  ptr = jobject_realloc(jhandle, jhandle->slab[0],
+			((size_t)jhandle->mask + 1) * sizeof(struct jobject),
+			(size_t)jhandle->used * sizeof(struct jobject));
+  if (!ptr) goto error;
+
+  jhandle->slab[0]   = (struct jobject *)ptr;
+  jhandle->jobject   = (struct jobject *)ptr;
+  jhandle->holestart = jhandle->used;
+  jhandle->holeend   = jhandle->mask + 1;
+  jhandle->count     = jhandle->used;
+#else
+  ptr = jobject_realloc(jhandle, jhandle->jobject,
+			(size_t)jhandle->count * sizeof(struct jobject),
+			(size_t)jhandle->used * sizeof(struct jobject));
+  if (!ptr) goto error;
+
+  jhandle->jobject = (struct jobject *)ptr;
+  jhandle->count   = jhandle->used;
+#endif
+  return 0;
+
+ error:
+  errno = ENOMEM;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void jobject_rewind(struct jhandle * const jhandle, joff_t used) {
+
+  /* Release every jobject from used onwards along with any spans that
+   * were recorded for them.
+   */
+  jhandle->used = used;
+
+  /* Released jobjects may lie beyond the new end of the pool, as may
+   * indexed arrays or their elements.
+   */
+  jhandle->nfree = 0;
+  if (jhandle->built > used) jhandle->built = 0;
+  jindex_truncate(jhandle, used);
+
+  while ((jhandle->nspan > 0) && 
+	 (jhandle->span[jhandle->nspan-1].node >= used)) {
+    if (jhandle->span[--jhandle->nspan].end == 0) jhandle->deadspans--;
+  }
+  jhandle->spanopen = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jspan_record(struct jhandle * const jhandle, joff_t first, 
+			 boff_t start, boff_t end) {
+
+  /* Containers are allocated after their children so spans arrive 
+   * already ordered by node.
+   */
+  struct jspan *span;
+
+  if (AM_UNLIKELY(jhandle->nspan == jhandle->spancount)) {
+
+    void *ptr;
+    joff_t ncount = (jhandle->spancount == 0)?64:(jhandle->spancount * 2);
+
+    if (AM_UNLIKELY(ncount <= jhandle->spancount)) goto error; /* overflow */
+
+    ptr = realloc(jhandle->span, (ncount * sizeof(struct jspan)));
+    if (!ptr) goto error;
+
+    jhandle->spancount = ncount;
+    jhandle->span      = (struct jspan *)ptr;
+  }
+
+  span            = &jhandle->span[jhandle->nspan++];
+  span->node      = jhandle->used - 1;
+  span->first     = first;
+  span->last      = span->node;
+  span->start     = start;
+  span->end       = end;
+  span->dirty     = 0;
+  span->scattered = 0;
+
+  /* Spans still waiting for a parent that were allocated from first
+   * onwards lie inside this container, the rest lie outside of it. The
+   * waiting spans are chained through parent.
+   */
+  while (jhandle->spanopen) {
+
+    struct jspan *child = &jhandle->span[jhandle->spanopen - 1];
+
+    if (child->node < first) break;
+    jhandle->spanopen = child->parent;
+    child->parent     = span->node;
+  }
+  span->parent      = jhandle->spanopen;
+  jhandle->spanopen = jhandle->nspan;
+  return;
+
+ error:
+  longjmp(jhandle->setjmp_ctx, 1);  /* jump back to amjson_decode() with ENOMEM */
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jspan_close(struct jhandle * const jhandle) {
+
+  /* Spans left waiting once a value is decoded are at its top */
+  while (jhandle->spanopen) {
+
+    struct jspan *span = &jhandle->span[jhandle->spanopen - 1];
+
+    jhandle->spanopen = span->parent;
+    span->parent      = span->node;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jspan_purge(struct jhandle * const jhandle) {
+
+  /* Drop the spans that no longer describe a live container, those left
+   * keep their order.
+   */
+  joff_t i;
+  joff_t n = 0;
+
+  for (i=0; i<jhandle->nspan; i++) {
+    if (jhandle->span[i].end != 0) jhandle->span[n++] = jhandle->span[i];
+  }
+
+  jhandle->nspan     = n;
+  jhandle->deadspans = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jobject_shift(struct jhandle * const jhandle, 
+			  struct jobject *jobject, struct jobject *skip,
+			  boff_t end, boff_t delta) {
+
+  /* Move the buffer offset of every string and number at or beyond end
+   * by delta, skip is a subtree that already refers to the new buffer.
+   */
+  if (jobject == skip) return;
+
+  switch (jobject->blen >> AMJSON_LENBITS) {
+
+  case AMJSON_STRING:
+  case AMJSON_NUMBER:
+    if ((!(jobject->blen & AMJSON_STRBUFMASK)) &&
+	(jobject->u.string.offset >= end)) {
+      jobject->u.string.offset += delta;
+    }
+    break;
+
+  case AMJSON_OBJECT:
+  case AMJSON_ARRAY:
+    if (jhandle->nspan) {
+
+      struct jspan *span = jspan_at(jhandle, JOBJECT_OFFSET(jhandle, jobject));
+
+      if (span) {
+	if (span->start >= end) span->start += delta;
+	if (span->end >= end) span->end += delta;
+      }
+    }
+
+    if (jobject->blen & AMJSON_LENMASK) {
+
+      struct jobject *child = JOBJECT_AT(jhandle, jobject->u.object.child);
+
+      for (; child; child = JOBJECT_NEXT(jhandle, child)) {
+	jobject_shift(jhandle, child, skip, end, delta);
+      }
+    }
+    break;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int jspan_follow(struct jhandle * const jhandle, struct jspan *span,
+			boff_t end, boff_t delta) {
+
+  /* Move everything that follows the container of span in the JSON 
+   * buffer, which is whatever each of its ancestors lists after it. The
+   * first pass only checks that the parent links still lead to the 
+   * root, if they do not -1 is returned and nothing has been moved.
+   */
+  int pass;
+
+  for (pass=0; pass<2; pass++) {
+
+    struct jspan *s = span;
+
+    while (s->parent != s->node) {
+
+      struct jspan *parent = jspan_at(jhandle, s->parent);
+      struct jobject *target = JOBJECT_AT(jhandle, s->node);
+      struct jobject *child;
+
+      if (!parent) return -1;
+
+      child = JOBJECT_AT(jhandle, parent->node);
+      if ((JOBJECT_TYPE(child) != AMJSON_OBJECT) && 
+	  (JOBJECT_TYPE(child) != AMJSON_ARRAY)) return -1;
+
+      child = OBJECT_FIRST_KEY(jhandle, child);
+      while ((child) && (child != target)) {
+	child = JOBJECT_NEXT(jhandle, child);
+      }
+      if (!child) return -1;
+
+      if (pass) {
+	while ((child = JOBJECT_NEXT(jhandle, child))) {
+	  jobject_shift(jhandle, child, (struct jobject *)0, end, delta);
+	}
+	parent->end += delta;
+      }
+      s = parent;
+    }
+
+    if (s->node != jhandle->root) return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_record_spans(struct jhandle *jhandle, int enable) {
+
+  jhandle->usespans = enable?1:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jspan *jspan_find(struct jhandle * const jhandle, struct jobject *jobject) {
+
+  return jspan_at(jhandle, JOBJECT_OFFSET(jhandle, jobject));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static joff_t jspan_search(struct jhandle * const jhandle, joff_t node) {
+
+  /* Spans are ordered by node so a binary search will do, the index of
+   * the first span at or after node is returned.
+   */
+  joff_t lo = 0;
+  joff_t hi = jhandle->nspan;
+
+  while (lo < hi) {
+
+    joff_t mid = lo + ((hi - lo) / 2);
+
+    if (jhandle->span[mid].node < node) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jspan *jspan_at(struct jhandle * const jhandle, joff_t node) {
+
+  joff_t i = jspan_search(jhandle, node);
+
+  if ((i < jhandle->nspan) && 
+      (jhandle->span[i].node == node) &&
+      (jhandle->span[i].end != 0)) {
+    return &jhandle->span[i];
+  }
+
+  return (struct jspan *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jspan *jspan_enclosing(struct jhandle * const jhandle, 
+				     joff_t node) {
+
+  /* Find the innermost container holding a jobject that has no span of
+   * its own. Contents are decoded next to the spans of their container 
+   * and its other contents, so the nearest live span on either side 
+   * leads to it through the parent links. Only contents a reparse left
+   * away from their container need every span to be looked at.
+   */
+  struct jspan *found = (struct jspan *)0;
+  joff_t lo = jspan_search(jhandle, node);
+  joff_t hi = lo;
+  joff_t i;
+  int side;
+
+  while ((hi < jhandle->nspan) && (jhandle->span[hi].end == 0)) hi++;
+  while ((lo > 0) && (jhandle->span[lo-1].end == 0)) lo--;
+
+  for (side=0; side<2; side++) {
+
+    struct jspan *s;
+
+    if (side == 0) {
+      if (hi == jhandle->nspan) continue;
+      s = &jhandle->span[hi];
+    } else {
+      if (lo == 0) continue;
+      s = &jhandle->span[lo-1];
+    }
+
+    while (s) {
+
+      if ((s->first <= node) && (node <= s->last)) {
+	if ((!found) || ((s->last - s->first) < (found->last - found->first))) {
+	  found = s;
+	}
+	break;
+      }
+      if (s->parent == s->node) break;
+      s = jspan_at(jhandle, s->parent);
+    }
+  }
+
+  if (found) return found;
+
+  for (i=0; i<jhandle->nspan; i++) {
+
+    struct jspan *s = &jhandle->span[i];
+
+    if (s->end == 0) continue;
+    if ((s->first <= node) && (node <= s->last)) {
+      if ((!found) || ((s->last - s->first) < (found->last - found->first))) {
+	found = s;
+      }
+    }
+  }
+
+  return found;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void jobject_modified(struct jhandle * const jhandle, struct jobject *jobject) {
+
+  /* Called by anything that changes a decoded jobject in place, before 
+   * the jobject changes type. The innermost container holding the 
+   * jobject and every container enclosing it can no longer be copied 
+   * verbatim.
+   */
+  struct jspan *span;
+  joff_t node;
+
+  jpath_clear(jhandle);
+
+  if ((jhandle->nspan == 0) && (jhandle->nindex == 0)) return;
+
+  node = JOBJECT_OFFSET(jhandle, jobject);
+
+  /* A container whose contents changed is indexed again when next used,
+   * as is an object whose key changed.
+   */
+  if (jhandle->nindex) {
+    jindex_remove(jhandle, node);
+    if ((jobject->blen >> AMJSON_LENBITS) == AMJSON_STRING) {
+      jindex_forget_key(jhandle, jobject);
+    }
+  }
+  if (jhandle->nspan == 0) return;
+
+  if (jhandle->deadspans > (jhandle->nspan / 2)) jspan_purge(jhandle);
+
+  /* A container without a span was built by the modification functions,
+   * whatever it was added to has been marked already.
+   */
+  if (!(span = jspan_at(jhandle, node))) {
+
+    unsigned int type = JOBJECT_TYPE(jobject);
+
+    if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) return;
+    if (!(span = jspan_enclosing(jhandle, node))) return;
+  }
+
+  /* The ancestors of a dirty container are always dirty */
+  while (!span->dirty) {
+
+    span->dirty = 1;
+    if (span->parent == span->node) break;
+    if (!(span = jspan_at(jhandle, span->parent))) break;
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static joff_t jindex_hash(joff_t node) {
+
+  return (joff_t)((uint32_t)node * 2654435761U);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int jindex_grow(struct jhandle * const jhandle) {
+
+  struct jindex *index;
+  joff_t count = (jhandle->indexcount == 0)?64:(jhandle->indexcount * 2);
+  joff_t i;
+
+  if (count <= jhandle->indexcount) return -1; /* overflow */
+
+  index = (struct jindex *)calloc(count, sizeof(struct jindex));
+  if (!index) return -1;
+
+  for (i=0; i<jhandle->indexcount; i++) {
+
+    struct jindex *entry = &jhandle->index[i];
+    joff_t slot;
+
+    if (!entry->count) continue;
+
+    slot = jindex_hash(entry->node) & (count - 1);
+    while (index[slot].count) slot = (slot + 1) & (count - 1);
+    index[slot] = *entry;
+  }
+
+  free(jhandle->index);
+  jhandle->index      = index;
+  jhandle->indexcount = count;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+uint32_t jindex_keyhash(char *ptr, jsize_t len) {
+
+  /* FNV-1a */
+  uint32_t hash = 2166136261U;
 
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,
-  0,1,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,1,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+  while (len--) {
+    hash ^= (unsigned char)*ptr++;
+    hash *= 16777619U;
+  }
+  return hash;
+}
 
-/* escaped is one of: '"', '\\', '/', 'b', 'f', 'n', 'r', 't'
-*/
-static unsigned char const escaped[] = {
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jindex *jindex_find(struct jhandle * const jhandle, 
+			   struct jobject *container, joff_t uses) {
+
+  /* Return the index of an array or object, its list is walked once and
+   * the index kept until the container is modified. Until the container
+   * has been asked for uses times only the count is kept and null is 
+   * returned, as is null if there is no memory for the index, the 
+   * caller then walks the list. An array is indexed by position. An 
+   * object is indexed by key in a hash table at most half full, keys
+   * are added in order so the first of any duplicates is found first.
+   * While the DOM is shared between threads only built indexes are 
+   * returned and the table is never changed.
+   */
+  joff_t node  = JOBJECT_OFFSET(jhandle, container);
+  joff_t count = ARRAY_COUNT(container);
+  joff_t pairs = count / 2;       /* An object counts keys and values */
+  joff_t size  = count;
+  struct jindex *entry = (struct jindex *)0;
+  joff_t *offset;
+  joff_t next;
+  joff_t slot;
+  joff_t i;
+
+  if (jhandle->indexcount) {
+
+    slot = jindex_hash(node) & (jhandle->indexcount - 1);
+    for (; jhandle->index[slot].count; 
+	 slot = (slot + 1) & (jhandle->indexcount - 1)) {
+
+      if (jhandle->index[slot].node == node) {
+	entry = &jhandle->index[slot];
+	break;
+      }
+    }
+  }
 
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,
-  0,0,1,0,0,0,1,0,0,0,0,0,0,0,1,0,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
-  
-/* whitespace is one of: '\t'  9
-                         '\n' 10
-                         '\r' 13
-                         ' '  32
-*/
-static unsigned char const whitespace[] = {
+  if ((entry) && ((entry->child != container->u.object.child) || 
+		  (entry->count != count))) {
+    if (jhandle->shared) return (struct jindex *)0;
+    jindex_remove(jhandle, node);
+    entry = (struct jindex *)0;
+  }
 
-  0,0,0,0,0,0,0,0,0,1,1,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+  if ((entry) && (entry->offset)) return entry;
 
-#define CONSUME_WHITESPACE(ptr, eptr)                       \
-                                                            \
-  do {							    \
-    for (;;) {                                              \
-      if (AM_UNLIKELY((ptr) == (eptr))) break;		    \
-      if (!whitespace[(unsigned char)(*(ptr))]) break;      \
-      ptr++;                                                \
-    }                                                       \
-  } while (0)
+  /* Other threads may be looking up the same tables */
+  if (jhandle->shared) return (struct jindex *)0;
+
+  if (!entry) {
+
+    if (((jhandle->nindex + 1) * 2 > jhandle->indexcount) &&
+	(jindex_grow(jhandle) != 0)) {
+      return (struct jindex *)0;
+    }
+
+    slot = jindex_hash(node) & (jhandle->indexcount - 1);
+    while (jhandle->index[slot].count) {
+      slot = (slot + 1) & (jhandle->indexcount - 1);
+    }
+
+    entry = &jhandle->index[slot];
+    entry->node   = node;
+    entry->child  = container->u.object.child;
+    entry->count  = count;
+    entry->size   = 0;
+    entry->uses   = 0;
+    entry->offset = (joff_t *)0;
+    jhandle->nindex++;
+  }
+
+  if (entry->uses < uses) {
+    entry->uses++;
+    return (struct jindex *)0;
+  }
+
+  if ((container->blen >> AMJSON_LENBITS) == AMJSON_OBJECT) {
+    for (size = 1; size < pairs * 2; size *= 2) {
+      if (size * 2 <= size) return (struct jindex *)0; /* overflow */
+    }
+  }
+
+  offset = (joff_t *)malloc((size_t)size * sizeof(joff_t));
+  if (!offset) return (struct jindex *)0;
+
+  next = container->u.object.child;
+  if ((container->blen >> AMJSON_LENBITS) == AMJSON_ARRAY) {
+
+    for (i=0; i<count; i++) {
+      offset[i] = next;
+      next = JOBJECT_AT(jhandle, next)->next;
+    }
+  } else {
+
+    for (i=0; i<size; i++) offset[i] = JOFF_MAX;
+
+    for (i=0; i<pairs; i++) {
+
+      struct jobject *key = JOBJECT_AT(jhandle, next);
+
+      slot = jindex_keyhash(JOBJECT_STRING_PTR(jhandle, key), 
+			    JOBJECT_STRING_LEN(key)) & (size - 1);
+      while (offset[slot] != JOFF_MAX) slot = (slot + 1) & (size - 1);
+      offset[slot] = next;
+
+      next = JOBJECT_AT(jhandle, key->next)->next;
+    }
+  }
+
+  entry->size   = size;
+  entry->offset = offset;
+  return entry;
+}
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-int amjson_alloc(struct jhandle * const jhandle, struct jobject *ptr,
-		 joff_t count) {
+static void jindex_remove(struct jhandle * const jhandle, joff_t node) {
 
-  memset(jhandle, 0, sizeof(struct jhandle));
-  
-  jhandle->count = count;
-  jhandle->root  = AMJSON_INVALID;
+  joff_t mask = jhandle->indexcount - 1;
+  joff_t slot;
+  joff_t i;
 
-  if (ptr) {
-    jhandle->userbuffer = (unsigned int)1;
-    jhandle->jobject    = ptr;
-    return 0;
+  slot = jindex_hash(node) & mask;
+  for (;;) {
+    if (!jhandle->index[slot].count) return;
+    if (jhandle->index[slot].node == node) break;
+    slot = (slot + 1) & mask;
   }
 
-  if (count == 0) goto error;
-  if ((jhandle->jobject = (struct jobject *)malloc((size_t)jhandle->count *
-						   sizeof(struct jobject)))) {
-    return 0;
+  free(jhandle->index[slot].offset);
+  jhandle->nindex--;
+
+  /* Close the gap so that later entries can still be found */
+  for (i = (slot + 1) & mask; jhandle->index[i].count; i = (i + 1) & mask) {
+
+    joff_t home = jindex_hash(jhandle->index[i].node) & mask;
+
+    if ((slot <= i)?((slot < home) && (home <= i)):
+	((slot < home) || (home <= i))) {
+      continue;
+    }
+
+    jhandle->index[slot] = jhandle->index[i];
+    slot = i;
   }
 
- error:
-  errno = EINVAL;
-  return -1;
+  jhandle->index[slot].count  = 0;
+  jhandle->index[slot].offset = (joff_t *)0;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-void amjson_free(struct jhandle *jhandle) {
+static void jindex_truncate(struct jhandle * const jhandle, joff_t used) {
 
-  if (!jhandle->userbuffer) {
-    free(jhandle->jobject);
+  /* Drop the indexes that refer to jobjects from used onwards, those of
+   * the rest of the DOM are still good. The path index only holds nodes
+   * reachable from the root, any change since it was built dropped it,
+   * so it is kept for as long as the root is.
+   */
+  joff_t i = 0;
+
+  while ((jhandle->nindex) && (i < jhandle->indexcount)) {
+
+    struct jindex *entry = &jhandle->index[i];
+    int drop;
+    joff_t j;
+
+    if (!entry->count) {
+      i++;
+      continue;
+    }
+
+    drop = ((entry->node >= used) || (entry->child >= used));
+    for (j=0; (!drop) && (entry->offset) && (j<entry->size); j++) {
+      drop = ((entry->offset[j] != JOFF_MAX) && (entry->offset[j] >= used));
+    }
+
+    /* Removal closes the gap with later entries, look at i again */
+    if (drop) {
+      jindex_remove(jhandle, entry->node);
+    } else {
+      i++;
+    }
   }
+
+  if (jhandle->root >= used) jpath_clear(jhandle);
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-int amjson_decode(struct jhandle * const jhandle, char *buf, bsize_t len) {
+static void jindex_forget_key(struct jhandle * const jhandle, 
+			      struct jobject *key) {
 
-  struct jobject *object;
-  char *ptr = buf;
+  /* Drop the index of any object holding a string as one of its keys. 
+   * The string still has the text it was hashed by, so each table is 
+   * probed just as a lookup of that text would.
+   */
+  joff_t node = JOBJECT_OFFSET(jhandle, key);
+  uint32_t hash = jindex_keyhash(JOBJECT_STRING_PTR(jhandle, key), 
+				 JOBJECT_STRING_LEN(key));
+  joff_t i = 0;
+
+  while ((jhandle->nindex) && (i < jhandle->indexcount)) {
+
+    struct jindex *entry = &jhandle->index[i];
+    int drop = 0;
+    joff_t mask;
+    joff_t slot;
+
+    if ((entry->count) && (entry->offset) &&
+	((JOBJECT_AT(jhandle, entry->node)->blen >> AMJSON_LENBITS) == 
+	 AMJSON_OBJECT)) {
+
+      mask = entry->size - 1;
+      for (slot = hash & mask; (!drop) && (entry->offset[slot] != JOFF_MAX);
+	   slot = (slot + 1) & mask) {
+	drop = (entry->offset[slot] == node);
+      }
+    }
+
+    /* Removal closes the gap with later entries, look at i again */
+    if (drop) {
+      jindex_remove(jhandle, entry->node);
+    } else {
+      i++;
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void jindex_clear(struct jhandle * const jhandle) {
+
+  joff_t i;
+
+  for (i=0; i<jhandle->indexcount; i++) {
+    free(jhandle->index[i].offset);
+  }
+
+  free(jhandle->index);
+  jhandle->index      = (struct jindex *)0;
+  jhandle->nindex     = 0;
+  jhandle->indexcount = 0;
+
+  jpath_clear(jhandle);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void jpath_clear(struct jhandle * const jhandle) {
+
+  /* Paths are resolved to offsets when the index is built, any change
+   * to the DOM may leave them naming the wrong jobject.
+   */
+  free(jhandle->pathindex);
+  jhandle->pathindex = (struct jpathindex *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_reparse(struct jhandle *jhandle, char *buf, bsize_t len,
+		   boff_t offset, bsize_t oldlen, bsize_t newlen) {
+
+  struct jspan *span;
+  struct jobject *jobject;
+  struct jobject *shell;
+  char *ptr;
+  joff_t used;
+  joff_t nspan;
+  joff_t index;
+  joff_t node;
+  joff_t count;
+  joff_t nnew;
+  joff_t lo;
+  joff_t capacity;
+  joff_t first;
+  joff_t limit;
+  joff_t i;
+  boff_t start;
+  boff_t end;
+  boff_t delta;
+  int depth;
+  int owned;
+  int move;
+
+  /* Find the smallest live container whose brackets lie outside of the
+   * edited bytes, everything outside of it is left untouched.
+   */
+  span  = (struct jspan *)0;
+  depth = 0;
+
+  for (i=0; i<jhandle->nspan; i++) {
+
+    struct jspan *s = &jhandle->span[i];
+
+    if (s->end == 0) continue;
+    if ((s->start < offset) && ((offset + oldlen) < s->end)) {
+
+      depth++;
+      if ((!span) || ((s->end - s->start) < (span->end - span->start))) {
+	span = s;
+      }
+    }
+  }
+
+  if ((!span) || (!jhandle->usespans)) {
+    jobject_rewind(jhandle, 0);
+    jhandle->root = AMJSON_INVALID;
+    return amjson_decode(jhandle, buf, len);
+  }
+
+  index = span - jhandle->span;     /* the span array may move */
+  start = span->start;
+  end   = span->end;
+  delta = (boff_t)(newlen - oldlen);   /* modular, may be "negative" */
+
+  if ((bsize_t)(boff_t)(end + delta) > len) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  used  = jhandle->used;
+  nspan = jhandle->nspan;
 
   jhandle->buf       = buf;
   jhandle->len       = len;
-  jhandle->eptr      = &buf[len];
+  jhandle->eptr      = &buf[(boff_t)(end + delta)];
   jhandle->max_depth = AMJSON_MAXDEPTH;
-  jhandle->depth     = 0;
+  jhandle->depth     = depth - 1;
   jhandle->useljmp   = 1;
 
   switch (setjmp(jhandle->setjmp_ctx)) {
 
   case 1:
-    /* We returned from calling amjson_element() with an 
-     * allocation failure.
-     */
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
     errno = ENOMEM;
     return -1;
 
   case 2:
-
-    /* We returned from calling amjson_element() with an 
-     * parser failure.
-     */
+    jhandle->useljmp = 0;
+    jobject_rewind(jhandle, used);
     errno = EINVAL;
     return -1;
   }
-  
-  amjson_element(jhandle, &ptr);
 
-  /* Our root object can be almost anything.
-   * The only guarentee we have is that it is something
-   * other than whitespace.
+  ptr = &buf[start];
+  amjson_value(jhandle, &ptr);
+  if (ptr != jhandle->eptr) longjmp(jhandle->setjmp_ctx, 2);
+
+  jhandle->useljmp = 0;
+  jspan_close(jhandle);
+
+  /* The container keeps its own slot, and with it its place in the
+   * parent's list, only its contents are swapped for the new subtree.
+   * The new shell was the last jobject and span allocated.
    */
-  object = JOBJECT_LAST(jhandle);
-  jhandle->root = JOBJECT_OFFSET(jhandle, object);
-  
-  return 0;
-}
+  span    = &jhandle->span[index];
+  node    = span->node;
+  jobject = JOBJECT_AT(jhandle, node);
+  shell   = JOBJECT_LAST(jhandle);
+  count   = jhandle->used - 1 - used;
+  nnew    = jhandle->nspan - 1 - nspan;
+
+  /* The old contents lie between first and last, around the container's
+   * own slot. Unless they were modified, or some of them were decoded 
+   * again elsewhere, they are the only jobjects there.
+   */
+  lo       = (span->first == node)?(span->first + 1):span->first;
+  capacity = (span->last < span->first)?0:(span->last - span->first + 1);
+  if ((span->first <= node) && (node <= span->last)) capacity--;
+
+  owned = ((!span->dirty) && (!span->scattered));
+  move  = owned;
+#ifdef AMJSON_SLABPOOL
+  if ((jhandle->holeend) && (capacity) &&
+      (lo < jhandle->holeend) && ((lo + capacity) > jhandle->holestart)) {
+    owned = 0;
+  }
+  if ((jhandle->holeend) && (count) &&
+      (used < jhandle->holeend) && ((used + count) > jhandle->holestart)) {
+    move = 0;
+  }
+#endif
+  move = ((owned) && (move) && (count <= capacity));
 
-/* -------------------------------------------------------------------- */
-/* -------------------------------------------------------------------- */
-struct jobject *jobject_allocate(struct jhandle * const jhandle, joff_t count) {
+  if (move) {
+    first = jspan_search(jhandle, lo);
+    limit = jspan_search(jhandle, lo + capacity);
+    if ((limit - first) < nnew) move = 0;
+  }
 
-  joff_t used = jhandle->used + count;
+  if (move) {
 
-  if (AM_UNLIKELY(used <= jhandle->used)) goto error; /* overflow */
-  if (AM_LIKELY(used < jhandle->count)) {
+    /* The new subtree is moved down into the slots of the old one so 
+     * that editing the same container again and again does not grow 
+     * the pool. Its spans take the places of the old spans.
+     */
+    joff_t distance = used - lo;
 
-    struct jobject *jobject = &jhandle->jobject[jhandle->used];
-    jhandle->used = used;
-    
-    return jobject;
-  }
+    for (i=lo; i<(lo + capacity); i++) {
+      jobject_discard(jhandle, JOBJECT_AT(jhandle, i));
+      JOBJECT_AT(jhandle, i)->next = AMJSON_INVALID;
+    }
 
-  if (!jhandle->userbuffer) {
-    
-    void *ptr;
-    joff_t ncount = (jhandle->count * 2) + count;
-    
-    if (AM_UNLIKELY(ncount <= jhandle->count)) goto error; /* overflow */
+    for (i=0; i<count; i++) {
 
-    ptr = realloc(jhandle->jobject, (ncount * sizeof(struct jobject)));	  
-    if (ptr) {
-      jhandle->count   = ncount;
-      jhandle->jobject = (struct jobject *)ptr;
-      return jobject_allocate(jhandle, count);
+      struct jobject *to = JOBJECT_AT(jhandle, lo + i);
+      unsigned int type;
+
+      *to  = *JOBJECT_AT(jhandle, used + i);
+      type = to->blen >> AMJSON_LENBITS;
+
+      if (to->next != AMJSON_INVALID) to->next -= distance;
+      if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+	  (OBJECT_COUNT(to))) {
+	to->u.object.child -= distance;
+      }
+    }
+
+    jobject->blen = shell->blen;
+    jobject->u    = shell->u;
+    if (OBJECT_COUNT(jobject)) jobject->u.object.child -= distance;
+
+    for (i=0; i<nnew; i++) {
+
+      struct jspan *to = &jhandle->span[first + i];
+
+      *to         = jhandle->span[nspan + i];
+      to->node   -= distance;
+      to->first  -= distance;
+      to->last   -= distance;
+      to->parent  = (to->parent == (jhandle->used - 1))?
+	node:(to->parent - distance);
+    }
+    jhandle->deadspans -= nnew;
+
+    /* Spans left over stay dead but must keep the array ordered */
+    for (; (first + i) < limit; i++) {
+      jhandle->span[first + i].node = 
+	(i == 0)?lo:jhandle->span[first + i - 1].node;
+    }
+
+    jhandle->used  = used;
+    jhandle->nspan = nspan;
+
+  } else {
+
+    /* The new subtree stays where it was decoded and the old one goes
+     * on to the free list. Containers around this one no longer hold all
+     * of their contents in their own range.
+     */
+    struct jspan *s = span;
+
+    if (owned) {
+      for (i=lo; i<(lo + capacity); i++) {
+	jobject_release(jhandle, JOBJECT_AT(jhandle, i));
+      }
+    } else if (((JOBJECT_TYPE(jobject) == AMJSON_OBJECT) || 
+		(JOBJECT_TYPE(jobject) == AMJSON_ARRAY)) &&
+	       (OBJECT_COUNT(jobject))) {
+      jobject_release_list(jhandle, jobject->u.object.child);
+    }
+
+    jobject->blen = shell->blen;
+    jobject->u    = shell->u;
+
+    for (i=nspan; i<(jhandle->nspan - 1); i++) {
+      if (jhandle->span[i].parent == (jhandle->used - 1)) {
+	jhandle->span[i].parent = node;
+      }
+    }
+
+    span->first     = used;
+    span->last      = jhandle->used - 2;
+    span->scattered = 0;
+
+    jhandle->used--;
+    jhandle->nspan--;
+
+    while ((s->parent != s->node) && (s = jspan_at(jhandle, s->parent))) {
+      s->scattered = 1;
     }
   }
 
- error:
-  if (jhandle->useljmp) {
-    /* The allocator is being used from with amjson_decode() 
-     * it's safe to jump right back to amjson_decode() 
-     */   
-    longjmp(jhandle->setjmp_ctx, 1);  /* jump back to amjson_decode() with ENOMEM */
+  span->dirty = 0;
+  span->end   = end + delta;
+
+  if (jhandle->nindex) jindex_remove(jhandle, node);
+
+  /* Everything that followed the container in the old buffer has moved
+   * by delta bytes. Only the DOM is walked as the pool may also hold 
+   * string text, and should the parent links no longer lead to the 
+   * root all of it is.
+   */
+  if ((delta != 0) && (jspan_follow(jhandle, span, end, delta) != 0)) {
+    jobject_shift(jhandle, JOBJECT_ROOT(jhandle), jobject, end, delta);
   }
-    
-  return (struct jobject *)0;
+
+  if (jhandle->deadspans > (jhandle->nspan / 2)) jspan_purge(jhandle);
+
+  return 0;
 }
 
 /* -------------------------------------------------------------------- */
@@ -274,14 +2019,13 @@ static void amjson_object(struct jhandle * const jhandle, char **optr) {
   struct jobject *object;
 
   joff_t first  = AMJSON_INVALID;
+  joff_t base   = jhandle->used;
   jsize_t count = 0;
 
   jhandle->depth++;
 
   if (jhandle->depth < jhandle->max_depth) {
 
-    struct jobject *string;
-    struct jobject *value;
     struct jobject *jobject;
 
     joff_t last = AMJSON_INVALID;
@@ -307,13 +2051,12 @@ static void amjson_object(struct jhandle * const jhandle, char **optr) {
     /* Add string to list */
     count++;
     
-    string = JOBJECT_LAST(jhandle);
     if (count == 1) {
-      first = JOBJECT_OFFSET(jhandle, string);
+      first = jhandle->used - 1;
       last  = first;
     } else {
       jobject = JOBJECT_AT(jhandle, last);
-      jobject->next = JOBJECT_OFFSET(jhandle, string);
+      jobject->next = jhandle->used - 1;
       last = jobject->next;
     }
     /* String added */
@@ -330,9 +2073,8 @@ static void amjson_object(struct jhandle * const jhandle, char **optr) {
     /* Add value to list */
     count++;
     
-    value = JOBJECT_LAST(jhandle);
     jobject = JOBJECT_AT(jhandle, last);
-    jobject->next = JOBJECT_OFFSET(jhandle, value);
+    jobject->next = jhandle->used - 1;
     last = jobject->next;
     /* Value added */
     
@@ -355,6 +2097,10 @@ static void amjson_object(struct jhandle * const jhandle, char **optr) {
   object->next           = AMJSON_INVALID;
   object->u.object.child = first;
 
+  if (jhandle->usespans) {
+    jspan_record(jhandle, base, *optr - jhandle->buf, ptr - jhandle->buf);
+  }
+
   jhandle->depth--;
 
   *optr = ptr;
@@ -373,13 +2119,13 @@ static void amjson_array(struct jhandle * const jhandle, char **optr) {
   struct jobject *array;
 
   joff_t first  = AMJSON_INVALID;
+  joff_t base   = jhandle->used;
   jsize_t count = 0;
 
   jhandle->depth++;
 
   if (jhandle->depth < jhandle->max_depth) {
 
-    struct jobject *value;
     struct jobject *jobject;
     joff_t last = AMJSON_INVALID;
   
@@ -399,13 +2145,12 @@ static void amjson_array(struct jhandle * const jhandle, char **optr) {
     /* Add value to list */
     count++;
     
-    value = JOBJECT_LAST(jhandle);
     if (count == 1) {
-      first = JOBJECT_OFFSET(jhandle, value);
+      first = jhandle->used - 1;
       last  = first;
     } else {
       jobject = JOBJECT_AT(jhandle, last);
-      jobject->next = JOBJECT_OFFSET(jhandle, value);
+      jobject->next = jhandle->used - 1;
       last = jobject->next;
     }
     /* Value added */
@@ -432,6 +2177,10 @@ static void amjson_array(struct jhandle * const jhandle, char **optr) {
   array->blen           = count | (AMJSON_ARRAY << AMJSON_LENBITS);
   array->next           = AMJSON_INVALID;
   array->u.object.child = first;
+
+  if (jhandle->usespans) {
+    jspan_record(jhandle, base, *optr - jhandle->buf, ptr - jhandle->buf);
+  }
   
   jhandle->depth--;
 
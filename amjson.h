@@ -66,6 +66,25 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 				   * now consume 16bytes instead of 12bytes on a 
 				   * 64 bit platform */
 
+#define AMJSON_SLABPOOL           /* Grow a managed jobject pool by adding
+				   * fixed size slabs rather than by calling
+				   * realloc(), jobjects are never copied 
+				   * and pointers to them remain valid until
+				   * amjson_free(). The cost is an extra
+				   * load for every offset lookup */
+
+#define AMJSON_SLABMIN  10        /* Slabs hold between 2^SLABMIN and */
+#define AMJSON_SLABMAX  20        /* 2^SLABMAX jobjects */
+
+#define AMJSON_INDEXMIN 32        /* Arrays and objects of at least this
+				   * many elements or keys are indexed by 
+				   * amjson_array_index() and 
+				   * amjson_object_find(), shorter ones are
+				   * walked */
+#define AMJSON_INDEXUSES 8        /* Lookups an object gets by scanning 
+				   * before its keys are hashed, hashing 
+				   * costs about this many scans */
+
 /* #define USECOMPUTEDGOTO */     /* Use GCC extension for computed gotos */
 /* #define USEBRANCHHINTS */      /* Use hints to aid branch prediction */
 
@@ -78,8 +97,11 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
        |  | |  |               automaticaly managed by the system. An 
        +--+ +--+               unmanaged pool will return ENOMEM in errno 
                                if it becomes full. A managed pool will be
-			       reallocated, if there is no available memory
-			       to reallocate ENOMEM will be returned in errno.
+			       grown, if there is no available memory
+			       to grow ENOMEM will be returned in errno.
+                               With AMJSON_SLABPOOL a managed pool grows a
+                               slab at a time and offsets are split into 
+                               a slab number and an index within the slab.
 
    JSON Buffer                 This is a collection of bytes that contains
    +---------------+           the JSON data that is to be parsed after the 
@@ -179,7 +201,8 @@ typedef uint8_t boff_t;
 #define AMJSON_TYPEMASK   ((JSIZE_MAX) << (AMJSON_LENBITS))
 
 /* String/Numbers are found in either the JSON buffer (STRJSONBUF) 
- * or the Jobject Pool (STRJOBJECTPOOL)
+ * or, when they were constructed, the string arena of the context
+ * (STRJOBJECTPOOL) which is flagged by AMJSON_STRBUFMASK
  */
 #define AMJSON_STRLENMASK ((JSIZE_MAX) >> (AMJSON_TYPEBITS+1))
 #define AMJSON_MAXSTR     AMJSON_STRLENMASK
@@ -224,6 +247,54 @@ struct jobject {
 
 } __attribute__((packed));
 
+struct jspan {
+
+  joff_t  node;                   /* Offset of the container in the pool */
+  joff_t  parent;                 /* Node of the enclosing container, node
+				   * itself at the top of the document */
+  joff_t  first;                  /* First and last jobject decoded for */
+  joff_t  last;                   /* the container and its contents */
+  boff_t  start;                  /* Offset of the opening '{' or '[' */
+  boff_t  end;                    /* Offset of the character after the
+				   * closing '}' or ']', 0 once the span
+				   * no longer describes a live container */
+  int     dirty;                  /* Container no longer matches the JSON
+				   * buffer between start and end */
+  int     scattered;              /* A reparse decoded some contents again
+				   * away from first and last, and put the
+				   * jobjects there on the free list */
+};
+
+struct jpathindex;                /* See amjson_path_index_build() */
+
+struct jindex {
+
+  joff_t  node;                   /* Offset of the container in the pool */
+  joff_t  child;                  /* First child and count when first */
+  joff_t  count;                  /* seen, count is 0 if the entry is 
+				   * unused */
+  joff_t  uses;                   /* Times asked for before offset is built */
+  joff_t  size;                   /* Entries in offset */
+  joff_t  *offset;                /* Offset of each element of an array,
+				   * or a hash table of the keys of an 
+				   * object with JOFF_MAX where unused.
+				   * Null until built */
+};
+
+struct jtext {
+
+  boff_t  offset;                 /* Released text in the string arena */
+  bsize_t len;
+};
+
+struct jallocator {
+
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*resize)(void *ctx, void *ptr, size_t oldsize, size_t size);
+  void  (*release)(void *ctx, void *ptr, size_t size);
+  void  *ctx;                     /* Passed to each of the above */
+};
+
 struct jhandle {
 
   char           *buf;            /* Unparsed json data, the JSON buffer */
@@ -231,12 +302,25 @@ struct jhandle {
                                    * the JSON buffer */
   unsigned int   userbuffer:1;    /* Did user supply the buffer? */
   unsigned int   useljmp:1;       /* We want to longjmp on allocation failure */
+  unsigned int   usespans:1;      /* Record container spans while decoding */
 
   bsize_t        len;             /* Length of json data */  
   jmp_buf        setjmp_ctx;      /* Allows us to return from allocation failure 
 				   * from deeply nested calls */
   
   struct jobject *jobject;        /* Preallocated jobject pool */
+  struct jallocator *allocator;   /* Pool memory, malloc() if null */
+#ifdef AMJSON_SLABPOOL
+  struct jobject **slab;          /* Pool slabs of 1 << shift jobjects */
+  joff_t         nslab;           /* Slabs allocated */
+  joff_t         slabcount;       /* Size of slab array */
+  joff_t         slabhint;        /* Slab last found by jobject_offset() */
+  unsigned int   shift;
+  joff_t         mask;            /* (1 << shift) - 1 */
+  joff_t         holestart;       /* Offsets from holestart up to holeend */
+  joff_t         holeend;         /* were released by jobject_shrink() and
+				   * are never allocated */
+#endif
   joff_t         count;           /* Size of jobject pool */
   joff_t         used;            /* Jobjects in use */
   joff_t         root;            /* Index of our root object */
@@ -244,24 +328,62 @@ struct jhandle {
   int            depth;
   int            max_depth;       /* RFC 8259 section 9 allows us to set a 
                                    * max depth for list and object traversal */
+
+  struct jspan   *span;           /* Container spans ordered by node */
+  joff_t         nspan;           /* Spans in use */
+  joff_t         spancount;       /* Size of span array */
+  joff_t         deadspans;       /* Spans with an end of 0 */
+  joff_t         spanopen;        /* Last span still waiting for its 
+				   * parent plus one, 0 if none */
+
+  char           *text;           /* String arena, text of constructed */
+  bsize_t        textused;        /* strings and numbers */
+  bsize_t        textsize;
+  bsize_t        textshared;      /* Text below this may be shared and
+				   * is never released */
+  struct jtext   *textfree;       /* Released text available for reuse */
+  joff_t         ntextfree;
+  joff_t         textfreecount;
+
+  joff_t         freelist;        /* Released jobjects linked by next */
+  joff_t         nfree;
+  joff_t         built;           /* Value last made by the functions in
+				   * extras/amjson_mod.h and not yet 
+				   * linked into the DOM plus one, 0 if 
+				   * none */
+
+  struct jindex  *index;          /* Indexed arrays and objects, hashed */
+  joff_t         nindex;          /* by node */
+  joff_t         indexcount;
+
+  struct jpathindex *pathindex;   /* Nodes by path, a single allocation
+				   * dropped whenever the DOM changes */
+  int            shared;          /* Set while several threads read the
+				   * DOM, indexes are used but not built */
 };
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
+#ifdef AMJSON_SLABPOOL
+#define JOBJECT_LAST(jhandle)          (JOBJECT_AT((jhandle), (jhandle)->used-1))
+#define JOBJECT_OFFSET(jhandle, o)     (jobject_offset((jhandle), (struct jobject *)(o)))
+#define JOBJECT_AT(jhandle, offset)    (&(jhandle)->slab[(offset) >> (jhandle)->shift][(offset) & (jhandle)->mask])
+#else
 #define JOBJECT_LAST(jhandle)          (&(jhandle)->jobject[(jhandle)->used-1])
 #define JOBJECT_OFFSET(jhandle, o)     ((((char *)(o)) - ((char *)&(jhandle)->jobject[0]))) / sizeof(struct jobject)
 #define JOBJECT_AT(jhandle, offset)    (&(jhandle)->jobject[(offset)])
+#endif
 
 /* -------------------------------------------------------------------- */
 
 #define JOBJECT_ROOT(jhandle)          (JOBJECT_AT((jhandle), (jhandle)->root))
 #define JOBJECT_NEXT(jhandle,o)        ((((o)->next) == AMJSON_INVALID)?(struct jobject *)0:(JOBJECT_AT((jhandle), ((o)->next))))
 
-#define JOBJECT_TYPE(o)                ((o)->blen >> AMJSON_LENBITS)!=AMJSON_OBJECT?((o)->blen >> AMJSON_LENBITS):(((OBJECT_COUNT(o)==0)&&((o)->u.object.child!=AMJSON_INVALID))?(o)->u.object.child:AMJSON_OBJECT)
+#define JOBJECT_TYPE(o)                (((o)->blen >> AMJSON_LENBITS)!=AMJSON_OBJECT?((o)->blen >> AMJSON_LENBITS):(((OBJECT_COUNT(o)==0)&&((o)->u.object.child!=AMJSON_INVALID))?(o)->u.object.child:AMJSON_OBJECT))
 
 #define JOBJECT_STRING_LEN(o)          ((o)->blen & AMJSON_STRLENMASK)
-#define JOBJECT_STRING_PTR(jhandle, o) (((o)->blen & AMJSON_STRBUFMASK)?((char *)(&(jhandle)->jobject[(o)->u.string.offset])):(&((jhandle)->buf[(o)->u.string.offset])))
+#define JOBJECT_STRING_PTR(jhandle, o) (((o)->blen & AMJSON_STRBUFMASK)?(&((jhandle)->text[(o)->u.string.offset])):(&((jhandle)->buf[(o)->u.string.offset])))
 
 #define ARRAY_COUNT(o)                 ((o)->blen & AMJSON_LENMASK)
 #define ARRAY_FIRST(jhandle, o)        ((((o)->blen & AMJSON_LENMASK) == 0)?(struct jobject *)0:(JOBJECT_AT((jhandle),(o)->u.object.child)))
@@ -278,6 +400,11 @@ struct jhandle {
 
 /* -------------------------------------------------------------------- */
 
+typedef int (*amjson_stream_fn)(struct jhandle *jhandle, 
+				struct jobject *jobject, void *arg);
+
+/* -------------------------------------------------------------------- */
+
 #ifndef __cplusplus
 #define REGISTER register
 #else
@@ -304,6 +431,47 @@ extern "C" {
  */
 int amjson_alloc(struct jhandle *jhandle, struct jobject *ptr, joff_t count);
 
+/* Summary: Create a new amjson context whose jobject pool is allocated 
+ *          by the caller's allocator.
+ * jhandle:   This is a pointer to an uninitialised jhandle structure.
+ * ptr:       As for amjson_alloc().
+ * count:     As for amjson_alloc().
+ * allocator: This is a pointer to the allocator to use, it must remain
+ *            valid until amjson_free() is called. If this is 
+ *            (struct jallocator *)0 malloc() is used.
+ *
+ * Every call receives the allocator's ctx. resize() and release() are 
+ * given the size the memory was allocated with, resize() is also used
+ * with a null ptr and an oldsize of 0 to allocate. alloc() and resize() 
+ * return null on failure, resize() then leaves ptr as it was.
+ * Return 0 on success and !0 on failure.
+ */
+int amjson_alloc_ex(struct jhandle *jhandle, struct jobject *ptr, 
+		    joff_t count, struct jallocator *allocator);
+
+#ifdef AMJSON_SLABPOOL
+/* Summary: Convert a pointer to a jobject held in the pool of jhandle 
+ *          back into its offset, this is used by JOBJECT_OFFSET().
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ * jobject: This is a pointer to a jobject in the pool.
+ *
+ * Return the offset of the jobject, AMJSON_INVALID if it is not in the
+ * pool.
+ */
+joff_t jobject_offset(struct jhandle *jhandle, struct jobject *jobject);
+#endif
+
+/* Summary: Count the jobjects that decoding a buffer holding JSON data
+ *          will use, without decoding it. The result can be passed as
+ *          the count to amjson_alloc() so the pool is the exact size.
+ * buf:     This is a pointer to a buffer holding JSON data.
+ * len:     This is the length of the JSON buffer in bytes.
+ *
+ * Return the count of jobjects, this is exact for valid JSON and is 
+ * meaningless for invalid JSON. 
+ */
+joff_t amjson_count(char *buf, bsize_t len);
+
 /* Summary: Decode a buffer holding JSON data using the amjson context 
  *          allocated by the call to amjson_alloc()
  * jhandle: This is a pointer to an initialised jhandle structure.
@@ -315,10 +483,74 @@ int amjson_alloc(struct jhandle *jhandle, struct jobject *ptr, joff_t count);
  * Return 0 on success and !0 on failure.
  * The value of errno will be set to EINVAL if an error ocurred parsing
  * the JSON buffer. ENOMEM indicates a problem allocating an object from
- * the jobject pool.
+ * the jobject pool. Any jobjects allocated by a failed decode are 
+ * released.
  */
 int amjson_decode(struct jhandle *jhandle, char *buf, bsize_t len);
 
+/* Summary: Decode a buffer holding a top level JSON array one element
+ *          at a time using the amjson context allocated by the call to
+ *          amjson_alloc()
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ * buf:     This is a pointer to a buffer holding JSON data to be parsed.
+ * len:     This is the length of the JSON buffer in bytes.
+ * fn:      Called with each decoded element, the element and any objects
+ *          allocated while it is being handled are released when fn 
+ *          returns. Return 0 to continue or !0 to stop.
+ * arg:     Opaque pointer passed to fn.
+ *
+ * The jobject pool only needs to be large enough for the largest 
+ * element rather than the whole buffer. If the buffer does not hold an
+ * array it is decoded as a whole and passed to fn once.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set as for amjson_decode() or to ECANCELED
+ * if fn asked to stop.
+ */
+int amjson_decode_stream(struct jhandle *jhandle, char *buf, bsize_t len,
+			 amjson_stream_fn fn, void *arg);
+
+/* Summary: Record the position of every object and array in the JSON 
+ *          buffer during subsequent decodes, this is required by 
+ *          amjson_reparse().
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ * enable:  !0 to record spans, 0 to stop recording them.
+ */
+void amjson_record_spans(struct jhandle *jhandle, int enable);
+
+/* Summary: Bring a decoded DOM up to date after the JSON buffer has been
+ *          edited, only the smallest object or array that encloses the
+ *          edit is parsed again.
+ * jhandle: This is a pointer to a jhandle that was decoded with spans 
+ *          being recorded.
+ * buf:     This is a pointer to the edited JSON buffer, it may differ
+ *          from the buffer originally decoded.
+ * len:     This is the length of the edited JSON buffer in bytes.
+ * offset:  Offset of the first byte that changed.
+ * oldlen:  Count of bytes that were replaced at offset.
+ * newlen:  Count of bytes that replaced them.
+ *
+ * The node of the enclosing container keeps its offset so references 
+ * to it and its ancestors stay valid, objects below it are replaced and
+ * their jobjects reused or released.
+ * If the edit is not inside any container the buffer is decoded again
+ * from scratch.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set as for amjson_decode(), after a 
+ * failure the DOM no longer matches the buffer and must be decoded 
+ * again.
+ */
+int amjson_reparse(struct jhandle *jhandle, char *buf, bsize_t len,
+		   boff_t offset, bsize_t oldlen, bsize_t newlen);
+
+/* Summary: Discard the decoded DOM so the context can decode another
+ *          buffer, the jobject pool is kept at the size it has grown to.
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ *
+ * Every jobject, offset and span is released, whether spans are being 
+ * recorded is unchanged.
+ */
+void amjson_reset(struct jhandle *jhandle);
+
 /* Summary: Release any resources held by an initialised amjson context.
  * jhandle: This is a pointer to an initialised jhandle structure.
  */
@@ -0,0 +1,63 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_util.h"
+#include "extras/amjson_parallel.h"
+
+/* -------------------------------------------------------------------- */
+
+#define WORKERS 4
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int score(struct jhandle *jhandle, struct jobject *jobject,
+		 joff_t index __attribute__((unused)), int worker, void *arg) {
+
+  long *total = (long *)arg;
+  struct jobject *value = amjson_object_find(jhandle, jobject, "score", 5);
+
+  /* Each worker adds to its own total, no locking is needed */
+  if ((value) && (JOBJECT_TYPE(value) == AMJSON_NUMBER)) {
+    total[worker] += strtol(JOBJECT_STRING_PTR(jhandle, value), 
+			    (char **)0, 10);
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  struct jhandle jhandle;
+  long total[WORKERS];
+  char *amjson = "[ { \"name\" : \"bob\", \"score\" : 12 },"
+                 "  { \"name\" : \"alice\", \"score\" : 30 },"
+                 "  { \"name\" : \"eve\", \"score\" : 7 },"
+                 "  { \"name\" : \"mallory\", \"score\" : 21 },"
+                 "  { \"name\" : \"trent\", \"score\" : 2 } ]";
+
+  memset(total, 0, sizeof(total));
+
+  if (amjson_alloc(&jhandle, (void *)0, 32) == 0) {
+    if (amjson_decode(&jhandle, amjson, strlen(amjson)) == 0) {
+      if (amjson_parallel_foreach(&jhandle, JOBJECT_ROOT(&jhandle), 
+				  score, total, WORKERS) == 0) {
+	int i;
+
+	for (i=1; i<WORKERS; i++) total[0] += total[i];
+	printf("total score:%ld\n", total[0]);
+      }
+    }
+    amjson_free(&jhandle);
+  }
+  
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -22,7 +22,7 @@ int main(int argc __attribute__((unused)),
      
       if ((jobject = amjson_query(&jhandle, JOBJECT_ROOT(&jhandle), "name"))) {
 
-	amjson_update(jobject, 
+	amjson_update(&jhandle, jobject, 
 		      amjson_string_new(&jhandle, "fred", strlen("fred")));
 
 	amjson_dump(&jhandle, JOBJECT_ROOT(&jhandle), 1, (char *)0, 0);
@@ -0,0 +1,41 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_batch.h"
+#include "extras/amjson_dump.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  struct jhandle jhandle;
+  struct jdoc doc[3];
+  char *amjson = "{ \"name\" : \"bob\" }"
+                 "{ \"name\" : \"alice\" }"
+                 "{ \"name\" : \"eve\" }";
+  
+  doc[0].offset = 0;  doc[0].len = 18;
+  doc[1].offset = 18; doc[1].len = 20;
+  doc[2].offset = 38; doc[2].len = 18;
+
+  if (amjson_alloc(&jhandle, (void *)0, 32) == 0) {
+    if (amjson_decode_batch(&jhandle, amjson, strlen(amjson), 
+			    doc, 3) == 0) {
+      int i;
+
+      for (i=0; i<3; i++) {
+	amjson_dump(&jhandle, JOBJECT_AT(&jhandle, doc[i].root), 1, (char *)0, 0);
+      }
+    }
+    amjson_free(&jhandle);
+  }
+  
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
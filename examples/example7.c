@@ -0,0 +1,44 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_dump.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  struct jhandle jhandle;
+  char amjson[128] = "{ \"server\" : { \"port\" : 8080, \"tls\" : false }, "
+                     "\"name\" : \"bob\" }";
+  char *edit = strstr(amjson, "8080");
+  
+  if (amjson_alloc(&jhandle, (void *)0, 32) == 0) {
+
+    amjson_record_spans(&jhandle, 1);
+
+    if (amjson_decode(&jhandle, amjson, strlen(amjson)) == 0) {
+      amjson_dump(&jhandle, JOBJECT_ROOT(&jhandle), 1, (char *)0, 0);
+
+      /* Replace 8080 with 443, only { "port" : 443, "tls" : false } is 
+       * parsed again.
+       */
+      memmove(edit + 3, edit + 4, strlen(edit + 4) + 1);
+      memcpy(edit, "443", 3);
+
+      if (amjson_reparse(&jhandle, amjson, strlen(amjson), 
+			 edit - amjson, 4, 3) == 0) {
+	amjson_dump(&jhandle, JOBJECT_ROOT(&jhandle), 1, (char *)0, 0);
+      }
+    }
+    amjson_free(&jhandle);
+  }
+  
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
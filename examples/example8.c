@@ -0,0 +1,48 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_stats.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  struct amjson_stats stats;
+  char *message[] = {
+    "{ \"id\" : 1, \"tags\" : [ \"a\", \"b\" ], \"ok\" : true }",
+    "{ \"id\" : 22, \"tags\" : [ \"c\" ], \"ok\" : false }",
+    "{ \"id\" : 333, \"tags\" : [ \"d\", \"e\", \"f\" ], \"ok\" : true }",
+    "{ \"id\" : 4, \"tags\" : [ ], \"ok\" : null }"
+  };
+  int i;
+
+  amjson_stats_init(&stats, 95);
+
+  for (i=0; i<4; i++) {
+
+    struct jhandle jhandle;
+    bsize_t len = strlen(message[i]);
+    joff_t guess = amjson_stats_guess(&stats, len);
+
+    if (amjson_alloc(&jhandle, (void *)0, guess) == 0) {
+      if (amjson_decode(&jhandle, message[i], len) == 0) {
+
+	printf("len:%d guess:%d used:%d\n", len, guess, jhandle.used);
+	amjson_stats_record(&stats, len, jhandle.used);
+      }
+      amjson_free(&jhandle);
+    }
+  }
+
+  /* Save this and hand it to amjson_stats_seed() after a restart */
+  printf("ratio:%u\n", amjson_stats_ratio(&stats));
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -0,0 +1,46 @@
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_pool.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(int argc __attribute__((unused)),
+	 char **argv __attribute__((unused))) {
+
+  char *message[] = {
+    "{ \"id\" : 1, \"tags\" : [ \"a\", \"b\" ], \"ok\" : true }",
+    "{ \"id\" : 22, \"tags\" : [ \"c\" ], \"ok\" : false }",
+    "{ \"id\" : 333, \"tags\" : [ \"d\", \"e\", \"f\" ], \"ok\" : true }",
+    "{ \"id\" : 4, \"tags\" : [ ], \"ok\" : null }"
+  };
+  int i;
+
+  for (i=0; i<4; i++) {
+
+    bsize_t len = strlen(message[i]);
+    struct jhandle *jhandle = amjson_handle_get(len);
+
+    if (jhandle) {
+      if (amjson_decode(jhandle, message[i], len) == 0) {
+
+	printf("len:%d count:%d used:%d", len, jhandle->count, jhandle->used);
+
+	/* Keep a DOM around for longer in as little memory as possible */
+	if (amjson_compact(jhandle) == 0) {
+	  printf(" compact count:%d", jhandle->count);
+	}
+	printf("\n");
+      }
+      amjson_handle_put(jhandle);
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -0,0 +1,91 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#include <errno.h>
+
+#include "amjson.h"
+#include "extras/amjson_batch.h"
+
+/* -------------------------------------------------------------------- */
+
+extern int jobject_decode(struct jhandle *jhandle, char *ptr, bsize_t len);
+extern int jobject_reserve(struct jhandle *jhandle, joff_t count);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_decode_batch(struct jhandle *jhandle, char *buf, bsize_t len,
+			struct jdoc *doc, size_t count) {
+
+  /* Keys are never copied out of the buffer, so equal keys across the 
+   * batch cost nothing more than the buffer already holds and need no
+   * interning. amjson_detach_batch() stores repeated keys once should
+   * the buffer be released.
+   */
+  size_t total = 0;
+  size_t failed = 0;
+  size_t i;
+
+  jhandle->buf = buf;
+  jhandle->len = len;
+
+  /* Size the pool once for the whole batch, should the guess be short 
+   * the pool still grows as usual.
+   */
+  for (i=0; i<count; i++) {
+    total += doc[i].len;
+  }
+  total = JOBJECT_COUNT_GUESS(total);
+  (void)jobject_reserve(jhandle, (total > JOFF_MAX/2)?JOFF_MAX/2:(joff_t)total);
+
+  for (i=0; i<count; i++) {
+
+    doc[i].root  = AMJSON_INVALID;
+    doc[i].error = 0;
+
+    if ((doc[i].offset > len) || (doc[i].len > (len - doc[i].offset))) {
+      doc[i].error = EINVAL;
+      failed++;
+      continue;
+    }
+
+    if (jobject_decode(jhandle, &buf[doc[i].offset], doc[i].len) != 0) {
+      doc[i].error = errno;
+      failed++;
+      continue;
+    }
+    doc[i].root = jhandle->root;
+  }
+
+  jhandle->eptr = &buf[len];
+
+  if (failed) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -0,0 +1,81 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMJSON_BATCH_H_
+#define _AMJSON_BATCH_H_
+
+#include <stddef.h>
+
+#include "amjson.h"
+
+/* -------------------------------------------------------------------- */
+
+struct jdoc {
+
+  bsize_t offset;                 /* Offset of the document into the
+				   * JSON buffer */
+  bsize_t len;                    /* Length of the document */
+  joff_t  root;                   /* Index of the root object, only valid
+				   * when error is 0 */
+  int     error;                  /* 0, EINVAL or ENOMEM */
+};
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Decode many documents found in one JSON buffer, appending
+ *          all of their DOMs to the jobject pool of a single context.
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ * buf:     This is a pointer to a buffer holding all of the documents.
+ * len:     This is the length of the JSON buffer in bytes.
+ * doc:     Array of documents, offset and len must be set by the caller,
+ *          root and error are set by this call.
+ * count:   Count of documents in the array.
+ *
+ * The pool is grown once for the whole batch and every document is
+ * released by a single call to amjson_free(). Keys refer to their text
+ * in the buffer and are never copied, so keys that repeat across the 
+ * batch need no interning. The first document may 
+ * have its root at offset 0, the same value as AMJSON_INVALID, so the
+ * error of a document and not its root tells whether it was decoded.
+ * Return 0 if every document decoded and !0 otherwise, the error of 
+ * each document is found in doc[n].error.
+ */
+int amjson_decode_batch(struct jhandle *jhandle, char *buf, bsize_t len,
+			struct jdoc *doc, size_t count);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
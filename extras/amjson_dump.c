@@ -31,9 +31,17 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "amjson.h"
 #include "extras/amjson_dump.h"
 
+/* -------------------------------------------------------------------- */
+
+extern struct jspan *jspan_find(struct jhandle *jhandle, struct jobject *jobject);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
+static void dump_minify(char *ptr, char *eptr, size_t *written, 
+			char *buf, size_t len);
+static int dump_verbatim(struct jhandle *jhandle, struct jobject *jobject,
+			 size_t *written, char *buf, size_t len);
 static void dump_spaces(int count, size_t *written, char *buf, size_t len);
 static void dump(struct jhandle *jhandle, struct jobject *jobject,
 		 int type, int depth, int pretty, size_t *written,
@@ -72,6 +80,59 @@ static void dump_spaces(int depth, size_t *written, char *buf, size_t len) {
   }
 }
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void dump_minify(char *ptr, char *eptr, size_t *written, 
+			char *buf, size_t len) {
+
+  /* Copy JSON text that is known to be valid dropping any whitespace 
+   * found outside of strings, runs without whitespace are copied in
+   * one go.
+   */
+  while (ptr < eptr) {
+
+    char *sptr = ptr;
+
+    while (ptr < eptr) {
+
+      if (*ptr == '"') {
+	for (ptr++; *ptr != '"'; ptr++) {
+	  if (*ptr == '\\') ptr++;
+	}
+      } else if ((*ptr == ' ') || (*ptr == '\t') || 
+		 (*ptr == '\n') || (*ptr == '\r')) {
+	break;
+      }
+      ptr++;
+    }
+
+    if (ptr != sptr) *written += cpyout(buf, len, sptr, ptr - sptr, *written);
+
+    while ((ptr < eptr) && 
+	   ((*ptr == ' ') || (*ptr == '\t') || 
+	    (*ptr == '\n') || (*ptr == '\r'))) {
+      ptr++;
+    }
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int dump_verbatim(struct jhandle *jhandle, struct jobject *jobject,
+			 size_t *written, char *buf, size_t len) {
+
+  /* A container that has not been modified since it was decoded is
+   * copied straight from the JSON buffer.
+   */
+  struct jspan *span = jspan_find(jhandle, jobject);
+
+  if ((!span) || (span->dirty)) return 0;
+
+  dump_minify(&jhandle->buf[span->start], &jhandle->buf[span->end], 
+	      written, buf, len);
+  return 1;
+}
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 static size_t cpyout(char *dst, size_t dlen, char *src, size_t slen, 
@@ -133,9 +194,11 @@ static void dump(struct jhandle *jhandle, struct jobject *jobject,
     switch (JOBJECT_TYPE(jobject)) {
 
     case AMJSON_STRING:
+      *written += cpyout(buf, len, "\"", 1, *written);
       *written += cpyout(buf, len, 
 			 JOBJECT_STRING_PTR(jhandle, jobject), JOBJECT_STRING_LEN(jobject), 
 			 *written);
+      *written += cpyout(buf, len, "\"", 1, *written);
       break;
     case AMJSON_NUMBER:
       *written += cpyout(buf, len, 
@@ -143,6 +206,7 @@ static void dump(struct jhandle *jhandle, struct jobject *jobject,
 			 *written);
       break;
     case AMJSON_OBJECT:
+      if ((!pretty) && (dump_verbatim(jhandle, jobject, written, buf, len))) break;
       *written += cpyout(buf, len, "{", 1, *written);
       if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
       dump(jhandle, OBJECT_FIRST_KEY(jhandle, jobject), AMJSON_OBJECT, depth+1, pretty, written, buf, len);
@@ -151,6 +215,7 @@ static void dump(struct jhandle *jhandle, struct jobject *jobject,
       *written += cpyout(buf, len, "}", 1, *written);
       break;
     case AMJSON_ARRAY:
+      if ((!pretty) && (dump_verbatim(jhandle, jobject, written, buf, len))) break;
       *written += cpyout(buf, len, "[", 1, *written);
       if (pretty) *written += cpyout(buf, len, "\n", 1, *written);
       dump(jhandle, ARRAY_FIRST(jhandle, jobject), AMJSON_ARRAY, depth+1, pretty, written, buf, len);
@@ -23,8 +23,12 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
 
+#define _GNU_SOURCE               /* mremap(), fallocate() and 
+				   * memfd_create() */
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -38,7 +42,64 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
+struct pool_region {
+
+  char   *ptr;                    /* Mapping of the region */
+  off_t  offset;                  /* Offset of the region in the file */
+  size_t size;                    /* Length of the mapping */
+};
+
+struct pool_file {
+
+  struct jallocator  allocator;   /* Must be first */
+  int                fd;
+  off_t              end;         /* File length, regions lie below it */
+  size_t             pagesize;
+  struct pool_region *region;
+  size_t             nregion;
+  size_t             regioncount;
+};
+
+#define IMAGE_MAGIC   "AMJSON\0\0" /* Leads every DOM image */
+#define IMAGE_VERSION 1
+#define IMAGE_ALIGN   64          /* Sections of an image start on a 
+				   * multiple of this */
+
+struct image_header {
+
+  char     magic[8];
+  uint32_t version;
+  uint16_t jobjectsize;           /* Layout width, an image can only be */
+  uint8_t  joffsize;              /* used by a build with the same */
+  uint8_t  boffsize;              /* AMJSON_12, AMJSON_6 or AMJSON_3 */
+  uint64_t size;                  /* Length of the image */
+  uint64_t used;                  /* Jobjects in the pool */
+  uint64_t root;
+  uint64_t pool;                  /* Offset of each section */
+  uint64_t text;
+  uint64_t textlen;
+  uint64_t buf;
+  uint64_t buflen;
+};
+
+/* -------------------------------------------------------------------- */
+
+extern void jindex_clear(struct jhandle *jhandle);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
 static int file_map(struct mhandle *mhandle, char *pathname, int flags);
+static int pool_temp(void);
+static struct pool_region *pool_find(struct pool_file *pool, void *ptr);
+static void *pool_alloc(void *ctx, size_t size);
+static void *pool_resize(void *ctx, void *ptr, size_t oldsize, 
+			 size_t size);
+static void pool_release(void *ctx, void *ptr, size_t size);
+static uint64_t image_align(uint64_t offset);
+static int image_write(struct jhandle *jhandle, int fd);
+static int image_map(struct jhandle *jhandle, int fd);
+static int image_check(struct jhandle *jhandle);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -85,3 +146,581 @@ int amjson_file_map(struct mhandle *mhandle, char *pathname, int flags) {
 
   return 0;
 }
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int pool_temp(void) {
+
+  /* An unnamed file in TMPDIR, removed as soon as it is open */
+  char *dir = getenv("TMPDIR");
+  char *path;
+  int fd;
+
+  if ((!dir) || (!*dir)) dir = "/tmp";
+
+  path = (char *)malloc(strlen(dir) + sizeof("/amjson.XXXXXX"));
+  if (!path) return -1;
+
+  strcpy(path, dir);
+  strcat(path, "/amjson.XXXXXX");
+
+  fd = mkstemp(path);
+  if (fd != -1) unlink(path);
+
+  free(path);
+  return fd;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct pool_region *pool_find(struct pool_file *pool, void *ptr) {
+
+  size_t i;
+
+  /* Most recent regions are the most likely to be resized */
+  for (i=pool->nregion; i>0; i--) {
+    if (pool->region[i-1].ptr == (char *)ptr) return &pool->region[i-1];
+  }
+  return (struct pool_region *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *pool_alloc(void *ctx, size_t size) {
+
+  /* Each allocation is a new region at the end of the file. The file is
+   * extended with ftruncate() so it stays sparse until the pool is 
+   * written, and the kernel is told the region is filled in order.
+   */
+  struct pool_file *pool = (struct pool_file *)ctx;
+  size_t len = (size + pool->pagesize - 1) & ~(pool->pagesize - 1);
+  char *ptr;
+
+  if ((len == 0) || (len < size)) return (void *)0;
+
+  if (pool->nregion == pool->regioncount) {
+
+    void *nptr;
+    size_t ncount = (pool->regioncount == 0)?64:(pool->regioncount * 2);
+
+    if (ncount <= pool->regioncount) return (void *)0; /* overflow */
+
+    nptr = realloc(pool->region, (ncount * sizeof(struct pool_region)));
+    if (!nptr) return (void *)0;
+
+    pool->regioncount = ncount;
+    pool->region      = (struct pool_region *)nptr;
+  }
+
+  if (ftruncate(pool->fd, pool->end + (off_t)len) != 0) return (void *)0;
+
+  ptr = (char *)mmap((void *)0, len, PROT_READ|PROT_WRITE, MAP_SHARED, 
+		     pool->fd, pool->end);
+  if (ptr == MAP_FAILED) {
+    (void)ftruncate(pool->fd, pool->end);
+    return (void *)0;
+  }
+
+  (void)madvise(ptr, len, MADV_SEQUENTIAL);
+
+  pool->region[pool->nregion].ptr    = ptr;
+  pool->region[pool->nregion].offset = pool->end;
+  pool->region[pool->nregion].size   = len;
+  pool->nregion++;
+  pool->end += len;
+
+  return ptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *pool_resize(void *ctx, void *ptr, size_t oldsize, 
+			 size_t size) {
+
+  struct pool_file *pool = (struct pool_file *)ctx;
+  struct pool_region *region;
+  size_t len = (size + pool->pagesize - 1) & ~(pool->pagesize - 1);
+  char *nptr;
+
+  if (!ptr) return pool_alloc(ctx, size);
+  if (!(region = pool_find(pool, ptr))) return (void *)0;
+
+  if ((len == 0) || (len < size)) return (void *)0;
+  if (len <= region->size) return ptr;
+
+  /* The last region in the file grows in place */
+  if ((region->offset + (off_t)region->size) == pool->end) {
+
+    if (ftruncate(pool->fd, region->offset + (off_t)len) != 0) {
+      return (void *)0;
+    }
+
+    nptr = (char *)mremap(region->ptr, region->size, len, MREMAP_MAYMOVE);
+    if (nptr == MAP_FAILED) {
+      (void)ftruncate(pool->fd, pool->end);
+      return (void *)0;
+    }
+
+    (void)madvise(nptr, len, MADV_SEQUENTIAL);
+
+    region->ptr  = nptr;
+    region->size = len;
+    pool->end    = region->offset + (off_t)len;
+    return nptr;
+  }
+
+  /* Anything else is copied to a new region, which may move the table */
+  if (!(nptr = (char *)pool_alloc(ctx, size))) return (void *)0;
+
+  memcpy(nptr, ptr, (oldsize < size)?oldsize:size);
+  pool_release(ctx, ptr, oldsize);
+  return nptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void pool_release(void *ctx, void *ptr, size_t size) {
+
+  struct pool_file *pool = (struct pool_file *)ctx;
+  struct pool_region *region;
+  off_t offset;
+  size_t len;
+  size_t i;
+
+  (void)size;
+
+  if (!(region = pool_find(pool, ptr))) return;
+
+  (void)munmap(region->ptr, region->size);
+  offset = region->offset;
+  len    = region->size;
+
+  *region = pool->region[--pool->nregion];
+
+  /* Give the space back to the file system, the file is cut back to the
+   * end of the last region still in use.
+   */
+  if ((offset + (off_t)len) == pool->end) {
+
+    pool->end = 0;
+    for (i=0; i<pool->nregion; i++) {
+      if ((pool->region[i].offset + (off_t)pool->region[i].size) > 
+	  pool->end) {
+	pool->end = pool->region[i].offset + (off_t)pool->region[i].size;
+      }
+    }
+    (void)ftruncate(pool->fd, pool->end);
+#ifdef FALLOC_FL_PUNCH_HOLE
+  } else {
+    (void)fallocate(pool->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+		    offset, (off_t)len);
+#endif
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jallocator *amjson_file_pool_open(char *pathname) {
+
+  struct pool_file *pool;
+  long pagesize = sysconf(_SC_PAGESIZE);
+
+  if (!(pool = (struct pool_file *)calloc(1, sizeof(struct pool_file)))) {
+    errno = ENOMEM;
+    return (struct jallocator *)0;
+  }
+
+  if (pathname) {
+    pool->fd = open(pathname, O_RDWR|O_CREAT|O_TRUNC, 0600);
+  } else {
+    pool->fd = pool_temp();
+  }
+
+  if (pool->fd == -1) {
+    free(pool);
+    errno = EIO;
+    return (struct jallocator *)0;
+  }
+
+  pool->pagesize          = (pagesize > 0)?(size_t)pagesize:4096;
+  pool->allocator.alloc   = pool_alloc;
+  pool->allocator.resize  = pool_resize;
+  pool->allocator.release = pool_release;
+  pool->allocator.ctx     = pool;
+
+  return &pool->allocator;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_file_pool_close(struct jallocator *allocator) {
+
+  struct pool_file *pool = (struct pool_file *)allocator->ctx;
+  size_t i;
+
+  for (i=0; i<pool->nregion; i++) {
+    (void)munmap(pool->region[i].ptr, pool->region[i].size);
+  }
+
+  close(pool->fd);
+  free(pool->region);
+  free(pool);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static uint64_t image_align(uint64_t offset) {
+
+  return (offset + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int image_write(struct jhandle *jhandle, int fd) {
+
+  /* An image is a header followed by the jobject pool, the string arena
+   * and the JSON buffer. Every link in the pool is an offset, so the 
+   * pool is written as it is and works wherever the image is mapped.
+   */
+  struct image_header header;
+  char *ptr;
+  joff_t i;
+
+  memset(&header, 0, sizeof(struct image_header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.version     = IMAGE_VERSION;
+  header.jobjectsize = (uint16_t)sizeof(struct jobject);
+  header.joffsize    = (uint8_t)sizeof(joff_t);
+  header.boffsize    = (uint8_t)sizeof(boff_t);
+  header.used        = jhandle->used;
+  header.root        = jhandle->root;
+  header.pool        = image_align(sizeof(struct image_header));
+  header.text        = image_align(header.pool + 
+			 (uint64_t)jhandle->used * sizeof(struct jobject));
+  header.textlen     = jhandle->textused;
+  header.buf         = image_align(header.text + header.textlen);
+  header.buflen      = (jhandle->buf)?jhandle->len:0;
+  header.size        = header.buf + header.buflen;
+
+  if ((off_t)header.size < 0) goto error;
+  if (ftruncate(fd, (off_t)header.size) != 0) goto error;
+
+  ptr = (char *)mmap((void *)0, (size_t)header.size, PROT_READ|PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) goto error;
+
+  memcpy(ptr, &header, sizeof(struct image_header));
+
+#ifdef AMJSON_SLABPOOL
+  /* Slab by slab, the hole left by jobject_shrink() stays zeroed */
+  for (i=0; i<jhandle->used; i+=(jhandle->mask + 1)) {
+
+    joff_t len = jhandle->used - i;
+
+    if (len > jhandle->mask + 1) len = jhandle->mask + 1;
+    if ((i == 0) && (jhandle->holeend) && (len > jhandle->holestart)) {
+      len = jhandle->holestart;
+    }
+
+    memcpy(&ptr[header.pool + (uint64_t)i * sizeof(struct jobject)],
+	   jhandle->slab[i >> jhandle->shift], 
+	   (size_t)len * sizeof(struct jobject));
+
+    if (i + jhandle->mask + 1 < i) break; /* overflow */
+  }
+#else
+  i = jhandle->used;
+  memcpy(&ptr[header.pool], jhandle->jobject, 
+	 (size_t)i * sizeof(struct jobject));
+#endif
+
+  if (header.textlen) {
+    memcpy(&ptr[header.text], jhandle->text, (size_t)header.textlen);
+  }
+  if (header.buflen) {
+    memcpy(&ptr[header.buf], jhandle->buf, (size_t)header.buflen);
+  }
+
+  (void)munmap(ptr, (size_t)header.size);
+  return 0;
+
+ error:
+  errno = EIO;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int image_map(struct jhandle *jhandle, int fd) {
+
+  struct image_header *header;
+  struct stat sb;
+  char *ptr;
+
+  if (fstat(fd, &sb) == -1) goto error;
+  if ((uint64_t)sb.st_size < sizeof(struct image_header)) goto invalid;
+
+  ptr = (char *)mmap((void *)0, (size_t)sb.st_size, PROT_READ, MAP_SHARED,
+		     fd, 0);
+  if (ptr == MAP_FAILED) goto error;
+
+  /* Reject an image written by another layout, or whose sections do not
+   * lie within it.
+   */
+  header = (struct image_header *)ptr;
+  if ((memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0) ||
+      (header->version != IMAGE_VERSION) ||
+      (header->jobjectsize != sizeof(struct jobject)) ||
+      (header->joffsize != sizeof(joff_t)) ||
+      (header->boffsize != sizeof(boff_t)) ||
+      (header->size != (uint64_t)sb.st_size) ||
+      (header->used == 0) || (header->used > JOFF_MAX) ||
+      (header->root >= header->used) ||
+      (header->pool != image_align(sizeof(struct image_header))) ||
+      (header->text < header->pool + 
+       header->used * sizeof(struct jobject)) ||
+      (header->textlen > BOFF_MAX) ||
+      (header->buf < header->text + header->textlen) ||
+      (header->buflen > BOFF_MAX) ||
+      (header->buf + header->buflen != header->size)) {
+    (void)munmap(ptr, (size_t)sb.st_size);
+    goto invalid;
+  }
+
+  /* The mapped pool is a user supplied pool, so nothing is allocated */
+  if ((amjson_alloc(jhandle, (struct jobject *)&ptr[header->pool], 
+		    (joff_t)header->used) != 0) ||
+      (jhandle->count < header->used)) {
+    (void)munmap(ptr, (size_t)sb.st_size);
+    goto invalid;
+  }
+
+  jhandle->used = (joff_t)header->used;
+  jhandle->root = (joff_t)header->root;
+
+  if (header->buflen) {
+    jhandle->buf  = &ptr[header->buf];
+    jhandle->len  = (bsize_t)header->buflen;
+    jhandle->eptr = &jhandle->buf[jhandle->len];
+  }
+
+  /* Text below textshared is never released */
+  jhandle->text       = &ptr[header->text];
+  jhandle->textused   = (bsize_t)header->textlen;
+  jhandle->textsize   = (bsize_t)header->textlen;
+  jhandle->textshared = (bsize_t)header->textlen;
+
+  return 0;
+
+ invalid:
+  errno = EINVAL;
+  return -1;
+
+ error:
+  errno = EIO;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int image_check(struct jhandle *jhandle) {
+
+  /* Every offset must stay within the image so that walking the DOM of
+   * a damaged file can never read outside of it.
+   */
+  joff_t i;
+
+  for (i=0; i<jhandle->used; i++) {
+
+    struct jobject *jobject = JOBJECT_AT(jhandle, i);
+    jsize_t type = jobject->blen >> AMJSON_LENBITS;
+
+    if (jobject->next >= jhandle->used) return -1;
+
+    if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) {
+
+      joff_t child = jobject->u.object.child;
+
+      /* An empty object may hold a literal in child */
+      if ((child >= jhandle->used) && 
+	  ((OBJECT_COUNT(jobject) != 0) || (child > AMJSON_NULL))) {
+	return -1;
+      }
+    } else {
+
+      boff_t offset = jobject->u.string.offset;
+      bsize_t len   = JOBJECT_STRING_LEN(jobject);
+      bsize_t limit = (jobject->blen & AMJSON_STRBUFMASK)?
+	jhandle->textused:jhandle->len;
+
+      if ((offset > limit) || (len > limit - offset)) return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_shm_create(struct jhandle *jhandle, char *name) {
+
+  int fd;
+
+  if (jhandle->used == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (name) {
+    fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+  } else {
+#ifdef MFD_ALLOW_SEALING
+    fd = memfd_create("amjson", MFD_ALLOW_SEALING);
+#else
+    fd = pool_temp();
+#endif
+  }
+
+  if (fd == -1) {
+    errno = EIO;
+    return -1;
+  }
+
+  if (image_write(jhandle, fd) != 0) {
+    close(fd);
+    if (name) (void)shm_unlink(name);
+    errno = EIO;
+    return -1;
+  }
+
+#ifdef F_SEAL_WRITE
+  /* Nobody, the caller included, can change an unnamed image now */
+  if (!name) {
+    (void)fcntl(fd, F_ADD_SEALS, 
+		F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+  }
+#endif
+
+  return fd;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_shm_attach(struct jhandle *jhandle, int fd) {
+
+  return image_map(jhandle, fd);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_save(struct jhandle *jhandle, char *pathname) {
+
+  /* Written beside pathname and renamed over it, so a reader never maps
+   * a snapshot that is only partly written.
+   */
+  char *path;
+  int fd;
+
+  if (jhandle->used == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  path = (char *)malloc(strlen(pathname) + sizeof(".XXXXXX"));
+  if (!path) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  strcpy(path, pathname);
+  strcat(path, ".XXXXXX");
+
+  if ((fd = mkstemp(path)) == -1) goto error;
+
+  if ((image_write(jhandle, fd) != 0) ||
+      (fchmod(fd, 0644) != 0) ||
+      (fsync(fd) != 0)) {
+    close(fd);
+    unlink(path);
+    goto error;
+  }
+
+  close(fd);
+  if (rename(path, pathname) != 0) {
+    unlink(path);
+    goto error;
+  }
+
+  free(path);
+  return 0;
+
+ error:
+  free(path);
+  errno = EIO;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_load_mmap(struct jhandle *jhandle, char *pathname) {
+
+  int fd;
+
+  if ((fd = open(pathname, O_RDONLY)) == -1) {
+    errno = EIO;
+    return -1;
+  }
+
+  if (image_map(jhandle, fd) != 0) {
+    int error = errno;
+
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  close(fd);
+
+  if (image_check(jhandle) != 0) {
+    amjson_unmap(jhandle);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_is_snapshot(char *pathname) {
+
+  char magic[sizeof(((struct image_header *)0)->magic)];
+  ssize_t len;
+  int fd;
+
+  if ((fd = open(pathname, O_RDONLY)) == -1) return 0;
+
+  len = read(fd, magic, sizeof(magic));
+  close(fd);
+
+  return ((len == (ssize_t)sizeof(magic)) && 
+	  (memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_unmap(struct jhandle *jhandle) {
+
+  /* The header lies just before the pool */
+  char *ptr = (char *)jhandle->jobject;
+  struct image_header *header;
+
+  if (ptr) {
+    ptr   -= image_align(sizeof(struct image_header));
+    header = (struct image_header *)ptr;
+    (void)munmap(ptr, (size_t)header->size);
+  }
+
+  jindex_clear(jhandle);
+  memset(jhandle, 0, sizeof(struct jhandle));
+  jhandle->root = AMJSON_INVALID;
+}
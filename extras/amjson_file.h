@@ -47,6 +47,114 @@ extern "C" {
 void amjson_file_unmap(struct mhandle *mhandle);
 int amjson_file_map(struct mhandle *mhandle, char *pathname, int flags);
 
+/* Summary: Return an allocator for amjson_alloc_ex() that keeps the 
+ *          jobject pool, and string arena, in a memory mapped file so
+ *          that a DOM larger than RAM is paged by the kernel like the
+ *          file it was decoded from.
+ * pathname: File to hold the pool, it is created or truncated. When 
+ *          (char *)0 an unnamed temporary file is made in TMPDIR.
+ *
+ * The file grows sparsely with ftruncate() as the pool grows and each
+ * mapping is marked with MADV_SEQUENTIAL as a pool is filled in order.
+ * Space is returned to the file system as the pool is released, a
+ * named file only chooses where the pool lives.
+ * Return a pointer to the allocator or (struct jallocator *)0 on
+ * failure, errno will be set to ENOMEM or EIO.
+ */
+struct jallocator *amjson_file_pool_open(char *pathname);
+
+/* Summary: Unmap and close a file opened by amjson_file_pool_open(),
+ *          any context using it must be released with amjson_free() 
+ *          first.
+ * allocator: This is a pointer returned by amjson_file_pool_open().
+ */
+void amjson_file_pool_close(struct jallocator *allocator);
+
+/* Summary: Copy a decoded DOM into a shared memory image that other
+ *          processes can attach with amjson_shm_attach() instead of 
+ *          decoding the document themselves.
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded DOM, it is left as it was.
+ * name:    Name of the POSIX shared memory object to create with 
+ *          shm_open(), it must not exist already. When (char *)0 the
+ *          image is held in an unnamed memfd that is sealed against 
+ *          any further change.
+ *
+ * The image holds the jobject pool, the string arena and a copy of the
+ * JSON buffer, call amjson_compact() and amjson_detach() first to share
+ * only what is reachable and leave the buffer behind. A named object
+ * is removed with shm_unlink() once every process has attached it.
+ * Return a file descriptor for the image, to be passed on or inherited
+ * across fork(), or -1 on failure with errno set to EINVAL or EIO.
+ */
+int amjson_shm_create(struct jhandle *jhandle, char *name);
+
+/* Summary: Map an image made by amjson_shm_create() read only and use 
+ *          it as the DOM of a context, nothing is decoded or copied.
+ * jhandle: This is a pointer to an uninitialised jhandle structure, it 
+ *          must be released with amjson_unmap() and not amjson_free().
+ * fd:      This is a file descriptor for the image, such as one from 
+ *          shm_open(name, O_RDONLY, 0). It may be closed once this 
+ *          returns.
+ *
+ * Every process attaching an image shares one copy of its pages. The
+ * JOBJECT_ macros, amjson_query() and amjson_dump() work as they would
+ * after a decode but the DOM must not be modified.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if fd does not hold an image
+ * made by a build with the same layout, or EIO if it could not be read.
+ */
+int amjson_shm_attach(struct jhandle *jhandle, int fd);
+
+/* Summary: Save a decoded DOM as a snapshot that amjson_load_mmap() can
+ *          use later without decoding the document again.
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded DOM, it is left as it was.
+ * pathname: File to hold the snapshot, it is replaced as a whole once 
+ *          the snapshot has been written.
+ *
+ * A snapshot is the same image amjson_shm_create() makes, a versioned
+ * header recording the layout width and the root, then the jobject 
+ * pool, the string arena and the JSON buffer. Call amjson_compact() and
+ * amjson_detach() first for the smallest snapshot.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL, ENOMEM or EIO on failure.
+ */
+int amjson_save(struct jhandle *jhandle, char *pathname);
+
+/* Summary: Map a snapshot written by amjson_save() read only and use it
+ *          as the DOM of a context, nothing is decoded or allocated.
+ * jhandle: This is a pointer to an uninitialised jhandle structure, it 
+ *          must be released with amjson_unmap() and not amjson_free().
+ * pathname: File holding the snapshot.
+ *
+ * The header is checked and every offset in the pool is checked to lie
+ * within the snapshot, which reads the pool once but not the text. As
+ * with amjson_shm_attach() the DOM must not be modified.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to EINVAL if the file is not a valid 
+ * snapshot for a build with this layout, or EIO if it could not be read.
+ */
+int amjson_load_mmap(struct jhandle *jhandle, char *pathname);
+
+/* Summary: Tell whether a file starts as a snapshot does, without 
+ *          mapping or checking it.
+ * pathname: File to look at.
+ *
+ * Only the leading magic of the header is read, so a JSON document is
+ * never taken for a snapshot, amjson_load_mmap() checks the rest.
+ * Return !0 if the file looks like a snapshot and 0 otherwise, or if it
+ * could not be read.
+ */
+int amjson_is_snapshot(char *pathname);
+
+/* Summary: Unmap the image used by a context, the context is left 
+ *          uninitialised.
+ * jhandle: This is a pointer to a jhandle set up by amjson_shm_attach()
+ *          or amjson_load_mmap().
+ */
+void amjson_unmap(struct jhandle *jhandle);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
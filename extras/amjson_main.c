@@ -44,6 +44,15 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "extras/amjson_file.h"
 #include "extras/amjson_dump.h"
 #include "extras/amjson_query.h"
+#include "extras/amjson_ndjson.h"
+#include "extras/amjson_pool.h"
+
+/* -------------------------------------------------------------------- */
+
+struct ndjson_stats {
+  size_t records;
+  size_t invalid;
+};
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -51,6 +60,30 @@ static double tstos(struct timespec* ts) {
   return (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
 }
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t traverse(struct jhandle *jhandle, struct jobject *jobject) {
+
+  /* Visit every jobject and touch what a reader would, the result only
+   * keeps the walk from being optimised away.
+   */
+  size_t sum = 1;
+  int type = JOBJECT_TYPE(jobject);
+
+  if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) {
+
+    struct jobject *child = ARRAY_FIRST(jhandle, jobject);
+
+    for (; child; child = ARRAY_NEXT(jhandle, child)) {
+      sum += traverse(jhandle, child);
+    }
+  } else if ((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) {
+    sum += JOBJECT_STRING_LEN(jobject);
+  }
+
+  return sum;
+}
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 static int local_mkstemp(char *tmpfile) {
@@ -128,6 +161,186 @@ static int copy_stdin(char *tmpfile) {
   return -1;
 }
 
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ndjson_record(struct jhandle *jhandle __attribute__((unused)), 
+			 struct jobject *jobject __attribute__((unused)), 
+			 size_t line, int error, void *arg) {
+
+  struct ndjson_stats *stats = (struct ndjson_stats *)arg;
+
+  /* Records are delivered in order so there is no need to lock */
+  stats->records++;
+  if (error) {
+    stats->invalid++;
+    if (error == ENOMEM) {
+      fprintf(stderr, "line %zu: Failed allocating memory\n", line);
+    } else {
+      fprintf(stderr, "line %zu: JSON invalid\n", line);
+    }
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int ndjson_main(char *filepath, struct mhandle *mhandle) {
+
+  struct ndjson_stats stats;
+
+  memset(&stats, 0, sizeof(struct ndjson_stats));
+
+  if (amjson_ndjson_decode(mhandle->buf, mhandle->len, 0, 
+			   AMJSON_NDJSON_ORDERED, ndjson_record, &stats) != 0) {
+    fprintf(stderr, "Failed decoding records\n");
+    return 1;
+  }
+
+  if (stats.invalid) {
+    fprintf(stderr, "NDJSON invalid [file:%s records:%zu invalid:%zu]\n",
+	    filepath, stats.records, stats.invalid);
+    return 1;
+  }
+
+  fprintf(stdout, "NDJSON valid [file:%s records:%zu]\n",
+	  filepath, stats.records);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int stream_element(struct jhandle *jhandle, struct jobject *jobject, 
+			  void *arg __attribute__((unused))) {
+
+  (void)amjson_dump(jhandle, jobject, 0, (char *)0, 0);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int stream_main(char *filepath) {
+
+  struct jhandle jhandle;
+  struct mhandle mhandle;
+  int status = 0;
+
+  /* Do not lock or populate the mapping, pages that have been decoded
+   * can then be dropped by the kernel and files larger than RAM can
+   * be processed.
+   */
+  if (amjson_file_map(&mhandle, filepath, 0) != 0) {
+    fprintf(stderr, "Failed mapping file\n");
+    return 1;
+  }
+  (void)posix_madvise(mhandle.buf, mhandle.len, POSIX_MADV_SEQUENTIAL);
+
+  if (amjson_alloc(&jhandle, (struct jobject *)0, 
+		   JOBJECT_COUNT_GUESS(64 * 1024)) != 0) {
+    fprintf(stderr, "JSON alloc failed\n");
+    amjson_file_unmap(&mhandle);
+    return 1;
+  }
+
+  if (amjson_decode_stream(&jhandle, mhandle.buf, mhandle.len, 
+			   stream_element, (void *)0) != 0) {
+    if (errno == ENOMEM) {
+      fprintf(stderr, "Failed allocating memory\n");
+    } else {
+      fprintf(stderr, "JSON invalid\n");
+    }
+    status = 1;
+  }
+
+  amjson_free(&jhandle);
+  amjson_file_unmap(&mhandle);
+  return status;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_print(struct jhandle *jhandle, struct jobject *jobject,
+		       void *arg __attribute__((unused))) {
+
+  (void)amjson_dump(jhandle, jobject, 1, (char *)0, 0);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_dump(struct jhandle *jhandle, char *path) {
+
+  struct jquery *query;
+  size_t found;
+
+  if ((query = amjson_query_compile(path)) == (struct jquery *)0) {
+    if (errno == ENOMEM) {
+      fprintf(stderr, "Failed allocating memory\n");
+    } else {
+      fprintf(stderr, "'%s' invalid query\n", path);
+    }
+    return 1;
+  }
+
+  /* Every match is printed, wildcards and the like can give many */
+  found = amjson_query_foreach(jhandle, JOBJECT_ROOT(jhandle), query, 
+			       query_print, (void *)0);
+  amjson_query_free(query);
+
+  if (found == 0) {
+    fprintf(stderr, "'%s' not found\n", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int snapshot_main(char *filepath, int dump, int pretty, 
+			 int benchmark, char *query) {
+
+  /* Return -1 when filepath is not a snapshot so it is decoded instead */
+  struct jhandle jhandle;
+  struct timespec start;
+  struct timespec end;
+  int status = 0;
+
+  if (!amjson_is_snapshot(filepath)) return -1;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (amjson_load_mmap(&jhandle, filepath) != 0) {
+    fprintf(stderr, "Snapshot invalid [file:%s]\n", filepath);
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fprintf(stdout, "Snapshot valid [file:%s jobject:%d]\n", 
+	  filepath, jhandle.used);
+
+  if (dump) {
+    (void)amjson_dump(&jhandle, (struct jobject *)0, 0, (char *)0, 0);
+  } else if (pretty) {
+    (void)amjson_dump(&jhandle, (struct jobject *)0, 1, (char *)0, 0);
+  } else if (benchmark) {
+
+    size_t sum;
+
+    fprintf(stdout, "Load time seconds:%f\n", tstos(&end) - tstos(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sum = traverse(&jhandle, JOBJECT_ROOT(&jhandle));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Traverse time seconds:%f [%lu]\n", 
+	    tstos(&end) - tstos(&start), (unsigned long)sum);
+
+  } else if (query) {
+    status = query_dump(&jhandle, query);
+  }
+
+  amjson_unmap(&jhandle);
+  return status;
+}
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 int main(int argc, char **argv) {
@@ -138,33 +351,65 @@ int main(int argc, char **argv) {
   int dump = 0; 
   int pretty = 0;
   int benchmark = 0;
+  int hugepage = 0;
+  struct jallocator *filepool = (struct jallocator *)0;
+  int ndjson = 0;
+  int stream = 0;
   char *query = (char *)0;
+  char *save = (char *)0;
   char tmpfile[] = "/tmp/amjson.XXXXXX";
 
   
-  if ((argc < 2) || (argc > 3)) {
+  if ((argc < 2) || (argc > 4) || 
+      ((argc == 4) && (strcmp(argv[2],"--save") != 0))) {
     fprintf(stderr, "Usage: %s filepath\n", argv[0]);
     fprintf(stderr, "       %s filepath query\n", argv[0]);
     fprintf(stderr, "       %s filepath --dump\n", argv[0]);
     fprintf(stderr, "       %s filepath --dump-pretty\n", argv[0]);
+    fprintf(stderr, "       %s filepath --ndjson\n", argv[0]);
+    fprintf(stderr, "       %s filepath --stream\n", argv[0]);
+    fprintf(stderr, "       %s filepath --save snapshot\n", argv[0]);
     fprintf(stderr, "\n");
-    fprintf(stderr, "filepath        - Path to file or '-' to read from stdin\n");
-    fprintf(stderr, "   query        - Path to JSON object to display\n");
+    fprintf(stderr, "filepath        - Path to file or '-' to read from stdin, or a snapshot\n");
+    fprintf(stderr, "   query        - Path to JSON object to display, eg. \"a.b[-1]\",\n");
+    fprintf(stderr, "                  \"[\\\"a.b\\\"]\" or the JSON Pointer \"/a/b/0\", every match\n");
+    fprintf(stderr, "                  of \"a[*].b\", \"a[1:5]\", \"..b\" or \"a[?(@.b > 1)]\" is shown\n");
     fprintf(stderr, "  --benchmark   - Map file and fill buffer cache, time decoding\n");
+    fprintf(stderr, "  --benchmark-hugepage - As --benchmark with the pool in huge pages\n");
+    fprintf(stderr, "  --benchmark-file - As --benchmark with the pool in a temporary file\n");
     fprintf(stderr, "  --dump        - Output compact JSON representation of data\n");
     fprintf(stderr, "  --dump-pretty - Output pretty printed JSON representation of data\n");
+    fprintf(stderr, "  --ndjson      - Validate newline delimited JSON records in parallel\n");
+    fprintf(stderr, "  --stream      - Output each top level array element on its own line\n");
+    fprintf(stderr, "  --save        - Write a snapshot of the DOM that can be read in place\n");
+    fprintf(stderr, "                  of filepath without decoding\n");
     return 1;
   }
 
   filepath = argv[1];
 
-  if (argc == 3) {  
+  if (argc == 4) {
+    save = argv[3];
+  } else if (argc == 3) {  
     if (strcmp(argv[2],"--dump") == 0) {
       dump = 1;  
     } else if (strcmp(argv[2],"--dump-pretty") == 0) {
       pretty = 1;
     } else if (strcmp(argv[2],"--benchmark") == 0) {
       benchmark = 1;
+    } else if (strcmp(argv[2],"--benchmark-hugepage") == 0) {
+      benchmark = 1;
+      hugepage  = 1;
+    } else if (strcmp(argv[2],"--benchmark-file") == 0) {
+      benchmark = 1;
+      if (!(filepool = amjson_file_pool_open((char *)0))) {
+	fprintf(stderr, "Failed creating pool file\n");
+	return 1;
+      }
+    } else if (strcmp(argv[2],"--ndjson") == 0) {
+      ndjson = 1;
+    } else if (strcmp(argv[2],"--stream") == 0) {
+      stream = 1;
     } else {
       query = argv[2];
     }
@@ -179,6 +424,26 @@ int main(int argc, char **argv) {
     filepath = tmpfile;
   }
 
+  if (stream) {
+    int status = stream_main(filepath);
+
+    if (filepath == tmpfile) {
+      unlink(tmpfile);
+    }
+    return status;
+  }
+
+  if ((!save) && (!ndjson)) {
+    int status = snapshot_main(filepath, dump, pretty, benchmark, query);
+
+    if (status != -1) {
+      if (filepath == tmpfile) {
+	unlink(tmpfile);
+      }
+      return status;
+    }
+  }
+
 #if 0
 #ifndef MAP_LOCKED
 #define MAP_LOCKED 0
@@ -190,18 +455,46 @@ int main(int argc, char **argv) {
 
   if (amjson_file_map(&mhandle, filepath, MAP_LOCKED|MAP_POPULATE) == 0) {
 
-    if (amjson_alloc(&jhandle, (struct jobject *)0, JOBJECT_COUNT_GUESS(mhandle.len)) == 0) {
+    if (ndjson) {
+      int status = ndjson_main(filepath, &mhandle);
+
+      amjson_file_unmap(&mhandle);
+      if (filepath == tmpfile) {
+	unlink(tmpfile);
+      }
+      return status;
+    }
+
+    if (amjson_alloc_ex(&jhandle, (struct jobject *)0, 
+			JOBJECT_COUNT_GUESS(mhandle.len),
+			(hugepage)?amjson_hugepage_allocator():
+			filepool) == 0) {
 
       struct timespec start;
       struct timespec end;
       double elapsed;
+      joff_t count = 0;
       
       if (benchmark) {
 	
 	mlockall(MCL_CURRENT|MCL_FUTURE);
+
+	/* Report what an exact sized pool would hold against the guess 
+	 * and what it costs to find out.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	count = amjson_count(mhandle.buf, mhandle.len);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = tstos(&end) - tstos(&start);
+
+	fprintf(stdout, "Count time seconds:%f [jobject:%d guess:%d]\n", 
+		elapsed, count, jhandle.count);
 	
 	clock_gettime(CLOCK_MONOTONIC, &start);
       }
+
+      /* Unmodified containers can then be copied straight from the file */
+      if (dump) amjson_record_spans(&jhandle, 1);
       
       if (amjson_decode(&jhandle, mhandle.buf, mhandle.len) == 0) {
 	
@@ -211,24 +504,43 @@ int main(int argc, char **argv) {
 		jhandle.used,
 		jhandle.len/jhandle.used);
 
-	if (dump) {
+	if (save) {
+
+	  /* Keep only what is reachable, and its text, not the file */
+	  if ((amjson_compact(&jhandle) != 0) || 
+	      (amjson_detach(&jhandle) != 0) ||
+	      (amjson_save(&jhandle, save) != 0)) {
+	    fprintf(stderr, "Failed saving snapshot\n");
+
+	    amjson_file_unmap(&mhandle);
+	    amjson_free(&jhandle);
+	    if (filepool) amjson_file_pool_close(filepool);
+	    if (filepath == tmpfile) {
+	      unlink(tmpfile);
+	    }
+	    return 1;
+	  }
+	} else if (dump) {
 	  (void)amjson_dump(&jhandle, (struct jobject *)0, 0, (char *)0, 0);
 	} else if (pretty) {
 	  (void)amjson_dump(&jhandle, (struct jobject *)0, 1, (char *)0, 0);
 	} else if (benchmark) {
 
+	  size_t sum;
+
 	  clock_gettime(CLOCK_MONOTONIC, &end);
 	  elapsed = tstos(&end) - tstos(&start);
 	  fprintf(stdout, "Ellapsed time seconds:%f\n", elapsed);
+
+	  clock_gettime(CLOCK_MONOTONIC, &start);
+	  sum = traverse(&jhandle, JOBJECT_ROOT(&jhandle));
+	  clock_gettime(CLOCK_MONOTONIC, &end);
+	  elapsed = tstos(&end) - tstos(&start);
+	  fprintf(stdout, "Traverse time seconds:%f [%lu]\n", elapsed, 
+		  (unsigned long)sum);
 	  
 	} else if (query) {
-	  struct jobject *jobject = amjson_query(&jhandle, JOBJECT_ROOT(&jhandle), query);
-	  if (jobject) {
-	    (void)amjson_dump(&jhandle, jobject, 1, (char *)0, 0);
-	  } else {
-	    fprintf(stderr, "'%s' not found\n", query);
-	    return 1;
-	  }
+	  if (query_dump(&jhandle, query) != 0) return 1;
 	}
 
       } else {
@@ -248,6 +560,7 @@ int main(int argc, char **argv) {
     amjson_file_unmap(&mhandle);
 
     amjson_free(&jhandle);
+    if (filepool) amjson_file_pool_close(filepool);
 
   } else {
     fprintf(stderr, "Failed mapping file\n");
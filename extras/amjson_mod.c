@@ -25,6 +25,7 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 
 #include "amjson.h"
 #include "extras/amjson_mod.h"
@@ -32,23 +33,48 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /* -------------------------------------------------------------------- */
 
 extern struct jobject *jobject_allocate(struct jhandle *jhandle, joff_t count);
+extern char *jstring_allocate(struct jhandle *jhandle, bsize_t len);
+extern void jobject_modified(struct jhandle *jhandle, struct jobject *jobject);
+extern void jobject_release(struct jhandle *jhandle, struct jobject *jobject);
+extern void jstring_release(struct jhandle *jhandle, boff_t offset, 
+			    bsize_t len);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
-static joff_t amjson_strdup(struct jhandle *jhandle, char *ptr, jsize_t len);
+static struct jobject *amjson_text_new(struct jhandle *jhandle, char *ptr, 
+				       jsize_t len, unsigned int type);
+static int amjson_release_keep(struct jhandle *jhandle, 
+			       struct jobject *jobject, struct jobject *keep);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-static joff_t amjson_strdup(struct jhandle *jhandle, char *ptr, jsize_t len) {
-
-  char *dptr = (char *)jobject_allocate(jhandle,
-					(len + (sizeof(struct jobject)-1)) / sizeof(struct jobject));
+static struct jobject *amjson_text_new(struct jhandle *jhandle, char *ptr, 
+				       jsize_t len, unsigned int type) {
+
+  /* The text is copied into the string arena, the jobject refers to it
+   * by offset as the arena may move.
+   */
+  struct jobject *jobject;
+  char *dptr;
+
+  if (len > AMJSON_MAXSTR) {
+    errno = EINVAL;
+    return (struct jobject *)0;
+  }
 
-  if (!dptr) return (joff_t)-1;
-  
+  if (!(dptr = jstring_allocate(jhandle, len))) return (struct jobject *)0;
   memcpy(dptr, ptr, len);
-  return JOBJECT_OFFSET(jhandle, dptr);
+
+  jobject = jobject_allocate(jhandle, 1);
+  if (!jobject) return (struct jobject *)0;
+
+  jobject->blen            = len | AMJSON_STRBUFMASK | (type << AMJSON_LENBITS);
+  jobject->next            = AMJSON_INVALID;
+  jobject->u.string.offset = dptr - jhandle->text;
+
+  jhandle->built = JOBJECT_OFFSET(jhandle, jobject) + 1;
+  return jobject;
 }
 
 /* -------------------------------------------------------------------- */
@@ -56,21 +82,15 @@ static joff_t amjson_strdup(struct jhandle *jhandle, char *ptr, jsize_t len) {
 struct jobject *amjson_string_new(struct jhandle *jhandle,
 				  char *ptr, jsize_t len) {
 
-  /* TODO - check len overflow */
+  return amjson_text_new(jhandle, ptr, len, AMJSON_STRING);
+}
 
-  joff_t offset = amjson_strdup(jhandle, ptr, len);
-  if (offset != (joff_t)-1) {
-  
-    struct jobject *jobject = jobject_allocate(jhandle, 1);
-    if (!jobject) return (struct jobject *)0;
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_number_new(struct jhandle *jhandle,
+				  char *ptr, jsize_t len) {
 
-    jobject->blen            = len | AMJSON_STRBUFMASK | (AMJSON_STRING << AMJSON_LENBITS);
-    jobject->next            = AMJSON_INVALID;
-    jobject->u.string.offset = offset;
-    return jobject;
-  }
-  
-  return (struct jobject *)0;
+  return amjson_text_new(jhandle, ptr, len, AMJSON_NUMBER);
 }
 
 /* -------------------------------------------------------------------- */
@@ -105,6 +125,12 @@ struct jobject *amjson_object_add(struct jhandle *jhandle,
     }
     
     object->blen = (OBJECT_COUNT(object) + 2) | (AMJSON_OBJECT << AMJSON_LENBITS);
+    jobject_modified(jhandle, object);
+
+    if ((jhandle->built == string->next + 1) ||
+	(jhandle->built == JOBJECT_OFFSET(jhandle, string) + 1)) {
+      jhandle->built = 0;                     /* Now linked */
+    }
     return object;
   }
   
@@ -162,6 +188,8 @@ struct jobject *amjson_object_new(struct jhandle *jhandle, ...) {
   object->blen           = count | (AMJSON_OBJECT << AMJSON_LENBITS);
   object->next           = AMJSON_INVALID;
   object->u.object.child = first;
+
+  jhandle->built = JOBJECT_OFFSET(jhandle, object) + 1;
   return object;
 }
 
@@ -206,6 +234,8 @@ struct jobject *amjson_array_new(struct jhandle *jhandle, ...) {
   array->blen           = count | (AMJSON_ARRAY << AMJSON_LENBITS);
   array->next           = AMJSON_INVALID;
   array->u.object.child = first;
+
+  jhandle->built = JOBJECT_OFFSET(jhandle, array) + 1;
   return array;
 }
 
@@ -238,6 +268,11 @@ struct jobject *amjson_array_add(struct jhandle *jhandle,
     }
     
     array->blen = (ARRAY_COUNT(array) + 1) | (AMJSON_ARRAY << AMJSON_LENBITS);
+    jobject_modified(jhandle, array);
+
+    if (jhandle->built == JOBJECT_OFFSET(jhandle, value) + 1) {
+      jhandle->built = 0;                     /* Now linked */
+    }
     return array;
   }
 
@@ -247,15 +282,182 @@ struct jobject *amjson_array_add(struct jhandle *jhandle,
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-struct jobject *amjson_update(struct jobject *old,
+struct jobject *amjson_update(struct jhandle *jhandle,
+			      struct jobject *old,
 			      struct jobject *new) {
   
   joff_t next = old->next;
+  int owned = 0;
+
+  /* Spans are found by what old was rather than what it becomes */
+  jobject_modified(jhandle, old);
+
+  /* Whatever old held can no longer be reached. A value just built, or
+   * one held by old, is only a carrier for its value and is released
+   * once copied, any other value stays where it is linked.
+   */
+  if (old != new) {
+
+    unsigned int type = old->blen >> AMJSON_LENBITS;
+
+    if (jhandle->built == JOBJECT_OFFSET(jhandle, new) + 1) {
+      jhandle->built = 0;
+      owned = 1;
+    }
+
+    if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+	(OBJECT_COUNT(old))) {
+      owned |= amjson_release_keep(jhandle, 
+				   JOBJECT_AT(jhandle, old->u.object.child), 
+				   new);
+    } else if (((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) &&
+	       (old->blen & AMJSON_STRBUFMASK)) {
+      jstring_release(jhandle, old->u.string.offset, 
+		      JOBJECT_STRING_LEN(old));
+    }
+  }
+
   memcpy(old, new, sizeof(struct jobject));
   old->next = next;
 
+  if (owned) {
+    new->blen &= ~AMJSON_STRBUFMASK;          /* The text now belongs */
+    jobject_release(jhandle, new);            /* to old */
+  }
+
   return (struct jobject *)old;
 }
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
+static int amjson_release_keep(struct jhandle *jhandle, 
+			       struct jobject *jobject, struct jobject *keep) {
+
+  /* Release a list of jobjects and everything they contain, apart from
+   * keep which is being moved elsewhere. Return !0 if keep was found.
+   */
+  int found = 0;
+
+  for (;;) {
+
+    unsigned int type = jobject->blen >> AMJSON_LENBITS;
+    joff_t next = jobject->next;
+
+    if (jobject != keep) {
+
+      if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+	  (OBJECT_COUNT(jobject))) {
+	found |= amjson_release_keep(jhandle, 
+				     JOBJECT_AT(jhandle, jobject->u.object.child), 
+				     keep);
+      }
+      jobject_release(jhandle, jobject);
+    } else {
+      found = 1;
+    }
+
+    if (next == AMJSON_INVALID) break;
+    jobject = JOBJECT_AT(jhandle, next);
+  }
+
+  return found;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_release(struct jhandle *jhandle, struct jobject *jobject) {
+
+  unsigned int type = jobject->blen >> AMJSON_LENBITS;
+
+  if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+      (OBJECT_COUNT(jobject))) {
+    amjson_release_keep(jhandle, JOBJECT_AT(jhandle, jobject->u.object.child),
+			(struct jobject *)0);
+  }
+  jobject_release(jhandle, jobject);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_object_remove(struct jhandle *jhandle,
+				     struct jobject *object,
+				     char *key, jsize_t len) {
+
+  struct jobject *prev = (struct jobject *)0;
+  joff_t next;
+
+  if ((JOBJECT_TYPE(object) != AMJSON_OBJECT) || (OBJECT_COUNT(object) == 0)) {
+    return (struct jobject *)0;
+  }
+
+  next = object->u.object.child;
+  do {
+
+    struct jobject *string = JOBJECT_AT(jhandle, next);
+    struct jobject *value  = JOBJECT_AT(jhandle, string->next);
+
+    if ((JOBJECT_STRING_LEN(string) == len) &&
+	(memcmp(JOBJECT_STRING_PTR(jhandle, string), key, len) == 0)) {
+
+      /* Unlink the pair, an object left empty has no child */
+      if (prev) {
+	prev->next = value->next;
+      } else {
+	object->u.object.child = value->next;
+      }
+
+      object->blen = (OBJECT_COUNT(object) - 2) | (AMJSON_OBJECT << AMJSON_LENBITS);
+      jobject_modified(jhandle, object);
+
+      value->next = AMJSON_INVALID;
+      jobject_release(jhandle, string);
+      amjson_release(jhandle, value);
+      return object;
+    }
+
+    prev = value;
+    next = value->next;
+        
+  } while (next != AMJSON_INVALID);
+
+  return (struct jobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_array_remove(struct jhandle *jhandle,
+				    struct jobject *array, joff_t index) {
+
+  struct jobject *prev = (struct jobject *)0;
+  struct jobject *value;
+  joff_t next;
+
+  if ((JOBJECT_TYPE(array) != AMJSON_ARRAY) || (index >= ARRAY_COUNT(array))) {
+    return (struct jobject *)0;
+  }
+
+  next = array->u.object.child;
+  for (;;) {
+    value = JOBJECT_AT(jhandle, next);
+    if (index-- == 0) break;
+
+    prev = value;
+    next = value->next;
+  }
+
+  if (prev) {
+    prev->next = value->next;
+  } else {
+    array->u.object.child = value->next;
+  }
+
+  array->blen = (ARRAY_COUNT(array) - 1) | (AMJSON_ARRAY << AMJSON_LENBITS);
+  jobject_modified(jhandle, array);
+
+  value->next = AMJSON_INVALID;
+  amjson_release(jhandle, value);
+  return array;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -37,6 +37,7 @@ extern "C" {
 /* -------------------------------------------------------------------- */
 
 struct jobject *amjson_string_new(struct jhandle *jhandle, char *ptr, jsize_t len);
+struct jobject *amjson_number_new(struct jhandle *jhandle, char *ptr, jsize_t len);
 struct jobject *amjson_object_add(struct jhandle *jhandle,
 				struct jobject *object,
 				struct jobject *string,
@@ -46,9 +47,34 @@ struct jobject *amjson_array_new(struct jhandle *jhandle, ...);
 struct jobject *amjson_array_add(struct jhandle *jhandle,
 			       struct jobject *array,
 			       struct jobject *value);
-struct jobject *amjson_update(struct jobject *old,
+
+/* Summary: Replace a value in the DOM with another, in place.
+ * jhandle: This is a pointer to the jhandle structure holding the DOM,
+ *          released jobjects and text are returned to its free lists.
+ * old:     Value to be replaced, it keeps its place in its object or
+ *          array and everything it held is released.
+ * new:     Value to take its place.
+ *
+ * When new is the value last made by amjson_string_new(), 
+ * amjson_number_new(), amjson_object_new() or amjson_array_new() and
+ * has not yet been added anywhere, or is held within old, old takes 
+ * over its text and contents and the jobject of new is released, new 
+ * must not be used again. Any other value is copied and left where it
+ * is, the two places then share its text and contents and neither may
+ * be removed while the other is in use.
+ * Return old.
+ */
+struct jobject *amjson_update(struct jhandle *jhandle,
+			      struct jobject *old,
 			      struct jobject *new);
 
+struct jobject *amjson_object_remove(struct jhandle *jhandle,
+				     struct jobject *object,
+				     char *key, jsize_t len);
+struct jobject *amjson_array_remove(struct jhandle *jhandle,
+				    struct jobject *array, joff_t index);
+void amjson_release(struct jhandle *jhandle, struct jobject *jobject);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
@@ -0,0 +1,400 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "amjson.h"
+#include "extras/amjson_ndjson.h"
+
+/* -------------------------------------------------------------------- */
+
+extern int jobject_decode(struct jhandle *jhandle, char *ptr, bsize_t len);
+
+/* -------------------------------------------------------------------- */
+
+struct record {
+
+  char   *buf;                    /* Start of the line, strings offsets 
+				   * are relative to this */
+  size_t line;
+  joff_t root;
+  int    error;
+};
+
+struct ndjson {
+
+  char             *buf;
+  char             *eptr;
+  size_t           nblock;        /* Count of AMJSON_NDJSON_BLOCK blocks */
+  size_t           *line;         /* Line number of the first line that 
+				   * starts in each block */
+
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  size_t           next;          /* Next block to hand to a worker */
+  size_t           turn;          /* Next block to deliver when ordered */
+  int              stop;
+  int              error;
+
+  int              flags;
+  amjson_ndjson_fn fn;
+  void             *arg;
+};
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static size_t ndjson_next(struct ndjson *ndjson);
+static void ndjson_stop(struct ndjson *ndjson, int error);
+static size_t count_newlines(char *ptr, char *eptr);
+static int blank_line(char *ptr, char *eptr);
+static int deliver(struct ndjson *ndjson, struct jhandle *jhandle, 
+		   struct record *record);
+static void *count_worker(void *arg);
+static void *decode_worker(void *arg);
+static void run_workers(struct ndjson *ndjson, int threads, 
+			void *(*worker)(void *));
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t ndjson_next(struct ndjson *ndjson) {
+
+  size_t block;
+
+  pthread_mutex_lock(&ndjson->lock);
+  if (ndjson->stop) {
+    block = ndjson->nblock;
+  } else {
+    block = ndjson->next;
+    if (block < ndjson->nblock) ndjson->next++;
+  }
+  pthread_mutex_unlock(&ndjson->lock);
+
+  return block;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void ndjson_stop(struct ndjson *ndjson, int error) {
+
+  pthread_mutex_lock(&ndjson->lock);
+  ndjson->stop = 1;
+  if (!ndjson->error) ndjson->error = error;
+  pthread_cond_broadcast(&ndjson->cond);
+  pthread_mutex_unlock(&ndjson->lock);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t count_newlines(char *ptr, char *eptr) {
+
+  size_t count = 0;
+
+  /* memchr() is vectorised by the C library, it is the fastest way 
+   * we have of finding record boundaries.
+   */
+  while ((ptr < eptr) && 
+	 ((ptr = (char *)memchr(ptr, '\n', eptr - ptr)))) {
+    count++;
+    ptr++;
+  }
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int blank_line(char *ptr, char *eptr) {
+
+  for (; ptr < eptr; ptr++) {
+    if ((*ptr != ' ') && (*ptr != '\t') && (*ptr != '\r')) return 0;
+  }
+  return 1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int deliver(struct ndjson *ndjson, struct jhandle *jhandle, 
+		   struct record *record) {
+
+  struct jobject *jobject = (struct jobject *)0;
+
+  jhandle->buf = record->buf;
+  if (!record->error) {
+    jhandle->root = record->root;
+    jobject = JOBJECT_ROOT(jhandle);
+  }
+
+  if (ndjson->fn(jhandle, jobject, record->line, record->error, ndjson->arg)) {
+    ndjson_stop(ndjson, ECANCELED);
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *count_worker(void *arg) {
+
+  struct ndjson *ndjson = (struct ndjson *)arg;
+  size_t block;
+
+  /* A line belongs to the block holding its first character, so the 
+   * lines starting in block n are counted by the newlines in the range
+   * [n*AMJSON_NDJSON_BLOCK-1, (n+1)*AMJSON_NDJSON_BLOCK-1) ignoring any
+   * newline at the very end of the buffer.
+   */
+  while ((block = ndjson_next(ndjson)) != ndjson->nblock) {
+
+    char *ptr  = &ndjson->buf[block * AMJSON_NDJSON_BLOCK];
+    char *eptr = ptr + AMJSON_NDJSON_BLOCK - 1;
+
+    if (eptr > ndjson->eptr - 1) eptr = ndjson->eptr - 1;
+
+    if (block == 0) {
+      ndjson->line[block] = 1 + count_newlines(ptr, eptr);
+    } else {
+      ndjson->line[block] = count_newlines(ptr - 1, eptr);
+    }
+  }
+
+  return (void *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *decode_worker(void *arg) {
+
+  struct ndjson *ndjson = (struct ndjson *)arg;
+  struct jhandle jhandle;
+  struct record *record = (struct record *)0;
+  size_t nrecord = 0;
+  size_t size    = 0;
+  size_t guess   = JOBJECT_COUNT_GUESS(AMJSON_NDJSON_BLOCK);
+  size_t block;
+
+  /* The pool grows as needed, narrow layouts start at their limit */
+  if (guess > JOFF_MAX) guess = JOFF_MAX;
+
+  if (amjson_alloc(&jhandle, (struct jobject *)0, (joff_t)guess) != 0) {
+    ndjson_stop(ndjson, ENOMEM);
+    return (void *)0;
+  }
+
+  while ((block = ndjson_next(ndjson)) != ndjson->nblock) {
+
+    char *ptr  = &ndjson->buf[block * AMJSON_NDJSON_BLOCK];
+    char *bptr = ptr + AMJSON_NDJSON_BLOCK;
+    size_t line = ndjson->line[block];
+
+    if (bptr > ndjson->eptr) bptr = ndjson->eptr;
+
+    /* Find the first line that starts in this block */
+    if (block != 0) {
+      ptr = (char *)memchr(ptr - 1, '\n', ndjson->eptr - (ptr - 1));
+      ptr = (ptr)?ptr + 1:ndjson->eptr;
+    }
+
+    nrecord = 0;
+    amjson_reset(&jhandle);
+
+    for (; ptr < bptr; ptr++, line++) {
+
+      struct record current;
+      char *eptr = (char *)memchr(ptr, '\n', ndjson->eptr - ptr);
+
+      if (!eptr) eptr = ndjson->eptr;
+      if (blank_line(ptr, eptr)) {
+	ptr = eptr;
+	continue;
+      }
+      
+      current.buf   = ptr;
+      current.line  = line;
+      current.root  = AMJSON_INVALID;
+      current.error = 0;
+
+      if ((size_t)(eptr - ptr) > BOFF_MAX) {
+	current.error = EINVAL;
+      } else {
+	jhandle.buf = ptr;
+	jhandle.len = eptr - ptr;
+	if (jobject_decode(&jhandle, ptr, eptr - ptr) == 0) {
+	  current.root = jhandle.root;
+	} else {
+	  current.error = errno;
+	}
+      }
+      ptr = eptr;
+
+      if (!(ndjson->flags & AMJSON_NDJSON_ORDERED)) {
+	/* Unordered, hand the record over and reuse the pool */
+	if (deliver(ndjson, &jhandle, &current) != 0) goto done;
+	amjson_reset(&jhandle);
+	continue;
+      }
+
+      /* Ordered, hold on to the DOM until it is our turn */
+      if (nrecord == size) {
+	size_t nsize = (size)?size * 2:64;
+	struct record *grow = (struct record *)realloc(record, nsize * 
+						      sizeof(struct record));
+	if (!grow) {
+	  ndjson_stop(ndjson, ENOMEM);
+	  goto done;
+	}
+	record = grow;
+	size   = nsize;
+      }
+      record[nrecord++] = current;
+    }
+
+    if (ndjson->flags & AMJSON_NDJSON_ORDERED) {
+      size_t i;
+
+      pthread_mutex_lock(&ndjson->lock);
+      while ((ndjson->turn != block) && (!ndjson->stop)) {
+	pthread_cond_wait(&ndjson->cond, &ndjson->lock);
+      }
+      pthread_mutex_unlock(&ndjson->lock);
+      if (ndjson->stop) goto done;
+
+      for (i=0; i<nrecord; i++) {
+	if (deliver(ndjson, &jhandle, &record[i]) != 0) goto done;
+      }
+
+      pthread_mutex_lock(&ndjson->lock);
+      ndjson->turn++;
+      pthread_cond_broadcast(&ndjson->cond);
+      pthread_mutex_unlock(&ndjson->lock);
+    }
+  }
+
+ done:
+  free(record);
+  amjson_free(&jhandle);
+  return (void *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void run_workers(struct ndjson *ndjson, int threads, 
+			void *(*worker)(void *)) {
+
+  pthread_t *thread = (pthread_t *)0;
+  int started = 0;
+  int i;
+
+  ndjson->next = 0;
+
+  /* The calling thread is always one of the workers, if we fail to
+   * start any others the work is still completed.
+   */
+  if (threads > 1) {
+    thread = (pthread_t *)malloc((threads - 1) * sizeof(pthread_t));
+  }
+
+  if (thread) {
+    for (i=0; i<threads-1; i++) {
+      if (pthread_create(&thread[started], (pthread_attr_t *)0,
+			 worker, ndjson) == 0) started++;
+    }
+  }
+
+  (void)worker(ndjson);
+
+  for (i=0; i<started; i++) {
+    pthread_join(thread[i], (void **)0);
+  }
+  free(thread);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_ndjson_decode(char *buf, size_t len, int threads, int flags,
+			 amjson_ndjson_fn fn, void *arg) {
+
+  struct ndjson ndjson;
+  size_t line;
+  size_t i;
+
+  if (len == 0) return 0;
+
+  memset(&ndjson, 0, sizeof(struct ndjson));
+
+  ndjson.buf    = buf;
+  ndjson.eptr   = &buf[len];
+  ndjson.nblock = (len + AMJSON_NDJSON_BLOCK - 1) / AMJSON_NDJSON_BLOCK;
+  ndjson.flags  = flags;
+  ndjson.fn     = fn;
+  ndjson.arg    = arg;
+
+  if (threads <= 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (online > 0)?(int)online:1;
+  }
+  if ((size_t)threads > ndjson.nblock) threads = (int)ndjson.nblock;
+
+  ndjson.line = (size_t *)malloc(ndjson.nblock * sizeof(size_t));
+  if (!ndjson.line) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  pthread_mutex_init(&ndjson.lock, (pthread_mutexattr_t *)0);
+  pthread_cond_init(&ndjson.cond, (pthread_condattr_t *)0);
+
+  /* First pass, count the lines starting in each block so that every
+   * worker knows the line numbers of the records it decodes.
+   */
+  run_workers(&ndjson, threads, count_worker);
+
+  for (line=1, i=0; i<ndjson.nblock; i++) {
+    size_t count = ndjson.line[i];
+
+    ndjson.line[i] = line;
+    line += count;
+  }
+
+  /* Second pass, decode the records */
+  run_workers(&ndjson, threads, decode_worker);
+
+  pthread_cond_destroy(&ndjson.cond);
+  pthread_mutex_destroy(&ndjson.lock);
+  free(ndjson.line);
+
+  if (ndjson.error) {
+    errno = ndjson.error;
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
@@ -0,0 +1,82 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMJSON_NDJSON_H_
+#define _AMJSON_NDJSON_H_
+
+#include <stddef.h>
+
+#include "amjson.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMJSON_NDJSON_BLOCK   (1024 * 1024) /* Bytes of input handed to a
+					     * worker at a time */
+
+#define AMJSON_NDJSON_ORDERED   0x01        /* Deliver records in line order */
+
+/* Called once for every non blank line. On success jobject is the root 
+ * of the decoded record and error is 0, the DOM is only valid for the 
+ * duration of the call. On failure jobject is (struct jobject *)0 and 
+ * error holds EINVAL or ENOMEM. Return 0 to continue or !0 to stop.
+ */
+typedef int (*amjson_ndjson_fn)(struct jhandle *jhandle, 
+				struct jobject *jobject,
+				size_t line, int error, void *arg);
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Decode a buffer of newline delimited JSON records using a
+ *          pool of worker threads, each with its own jhandle.
+ * buf:     Buffer holding the records, it is never modified.
+ * len:     Length of the buffer in bytes.
+ * threads: Number of workers, 0 uses one per online CPU.
+ * flags:   AMJSON_NDJSON_ORDERED delivers records in line order, 
+ *          otherwise records are delivered as soon as they are decoded
+ *          and fn may be called concurrently from several threads.
+ * fn:      Callback invoked for every record.
+ * arg:     Opaque pointer passed to fn.
+ *
+ * Malformed records are reported to fn and do not stop the batch.
+ * Return 0 on success and !0 on failure, errno is set to ENOMEM if
+ * the workers could not be started or ECANCELED if fn asked to stop.
+ */
+int amjson_ndjson_decode(char *buf, size_t len, int threads, int flags,
+			 amjson_ndjson_fn fn, void *arg);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
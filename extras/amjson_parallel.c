@@ -0,0 +1,320 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "amjson.h"
+#include "extras/amjson_parallel.h"
+
+/* -------------------------------------------------------------------- */
+
+extern struct jindex *jindex_find(struct jhandle *jhandle, 
+				  struct jobject *container, joff_t uses);
+
+/* -------------------------------------------------------------------- */
+
+struct parallel;
+
+struct worker {
+
+  pthread_mutex_t    lock;        /* Held by the owner and thieves */
+  joff_t             next;        /* First element of the run not taken */
+  joff_t             end;         /* Element after the last of the run */
+  int                stop;        /* Set once fn has asked to stop */
+
+  int                id;
+  pthread_t          thread;
+  struct parallel    *parallel;
+};
+
+struct parallel {
+
+  struct jhandle     *jhandle;
+  joff_t             *offset;     /* Pool offset of each element */
+  struct worker      *worker;
+  int                threads;
+
+  pthread_mutex_t    lock;
+  int                error;
+
+  amjson_parallel_fn fn;
+  void               *arg;
+};
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static joff_t *parallel_offsets(struct jhandle *jhandle, struct jobject *array,
+				int *owned);
+static void parallel_stop(struct parallel *parallel, int error);
+static int parallel_take(struct worker *worker, joff_t *first, joff_t *last);
+static int parallel_steal(struct worker *worker);
+static void *parallel_worker(void *arg);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static joff_t *parallel_offsets(struct jhandle *jhandle, struct jobject *array,
+				int *owned) {
+
+  struct jindex *entry = jindex_find(jhandle, array, 0);
+  joff_t count = ARRAY_COUNT(array);
+  joff_t *offset;
+  joff_t next;
+  joff_t i;
+
+  /* The index of the array is kept for later lookups, a private copy is
+   * only made when there is none, as when the DOM is already shared.
+   */
+  *owned = 0;
+  if (entry) return entry->offset;
+
+  offset = (joff_t *)malloc((size_t)count * sizeof(joff_t));
+  if (!offset) return (joff_t *)0;
+
+  next = array->u.object.child;
+  for (i=0; i<count; i++) {
+    offset[i] = next;
+    next = JOBJECT_AT(jhandle, next)->next;
+  }
+
+  *owned = 1;
+  return offset;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void parallel_stop(struct parallel *parallel, int error) {
+
+  int i;
+
+  pthread_mutex_lock(&parallel->lock);
+  if (!parallel->error) parallel->error = error;
+  pthread_mutex_unlock(&parallel->lock);
+
+  /* Empty every run, workers finish the element in hand and find 
+   * nothing left to take or steal. A thief that stole before the stop
+   * drops what it took rather than install it.
+   */
+  for (i=0; i<parallel->threads; i++) {
+    struct worker *worker = &parallel->worker[i];
+
+    pthread_mutex_lock(&worker->lock);
+    worker->next = worker->end;
+    worker->stop = 1;
+    pthread_mutex_unlock(&worker->lock);
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_take(struct worker *worker, joff_t *first, joff_t *last) {
+
+  joff_t count;
+
+  pthread_mutex_lock(&worker->lock);
+  count = worker->end - worker->next;
+  if (count > AMJSON_PARALLEL_GRAIN) count = AMJSON_PARALLEL_GRAIN;
+  *first = worker->next;
+  *last  = worker->next + count;
+  worker->next += count;
+  pthread_mutex_unlock(&worker->lock);
+
+  return (count)?0:-1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int parallel_steal(struct worker *worker) {
+
+  struct parallel *parallel = worker->parallel;
+  int i;
+
+  /* Visit the others in turn starting with our neighbour so that 
+   * thieves spread out, take the back half of the first run found.
+   * Elements in flight between two runs are never lost, the thief
+   * holding them processes them before looking for more.
+   */
+  for (i=1; i<parallel->threads; i++) {
+
+    struct worker *victim = &parallel->worker[(worker->id + i) % 
+					      parallel->threads];
+    joff_t first;
+    joff_t last;
+
+    pthread_mutex_lock(&victim->lock);
+    last  = victim->end;
+    first = last - (victim->end - victim->next) / 2;
+    if ((first == last) && (victim->next != victim->end)) first--;
+    victim->end = first;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (first != last) {
+      pthread_mutex_lock(&worker->lock);
+      if (!worker->stop) {
+	worker->next = first;
+	worker->end  = last;
+      }
+      pthread_mutex_unlock(&worker->lock);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *parallel_worker(void *arg) {
+
+  struct worker *worker = (struct worker *)arg;
+  struct parallel *parallel = worker->parallel;
+  struct jhandle *jhandle = parallel->jhandle;
+  joff_t first;
+  joff_t last;
+
+  do {
+    while (parallel_take(worker, &first, &last) == 0) {
+      for (; first < last; first++) {
+
+	struct jobject *jobject = JOBJECT_AT(jhandle, 
+					     parallel->offset[first]);
+
+	if (parallel->fn(jhandle, jobject, first, worker->id, 
+			 parallel->arg)) {
+	  parallel_stop(parallel, ECANCELED);
+	  return (void *)0;
+	}
+      }
+    }
+  } while (parallel_steal(worker) == 0);
+
+  return (void *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_parallel_foreach(struct jhandle *jhandle, struct jobject *array,
+			    amjson_parallel_fn fn, void *arg, int threads) {
+
+  struct parallel parallel;
+  joff_t count;
+  int shared;
+  int owned;
+  int started;
+  int i;
+
+  if (JOBJECT_TYPE(array) != AMJSON_ARRAY) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  count = ARRAY_COUNT(array);
+  if (count == 0) return 0;
+
+  memset(&parallel, 0, sizeof(struct parallel));
+
+  parallel.jhandle = jhandle;
+  parallel.fn      = fn;
+  parallel.arg     = arg;
+
+  if (threads <= 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (online > 0)?(int)online:1;
+  }
+  if ((joff_t)threads > count) threads = (int)count;
+
+  parallel.offset = parallel_offsets(jhandle, array, &owned);
+  if (!parallel.offset) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  parallel.worker = (struct worker *)malloc(threads * sizeof(struct worker));
+  if (!parallel.worker) {
+    if (owned) free(parallel.offset);
+    errno = ENOMEM;
+    return -1;
+  }
+  parallel.threads = threads;
+
+  pthread_mutex_init(&parallel.lock, (pthread_mutexattr_t *)0);
+
+  /* Equal runs, the first count % threads workers get one extra */
+  for (i=0; i<threads; i++) {
+    struct worker *worker = &parallel.worker[i];
+    joff_t share = count / threads;
+    joff_t extra = count % threads;
+
+    pthread_mutex_init(&worker->lock, (pthread_mutexattr_t *)0);
+    worker->next     = share * i + (((joff_t)i < extra)?(joff_t)i:extra);
+    worker->end      = worker->next + share + (((joff_t)i < extra)?1:0);
+    worker->stop     = 0;
+    worker->id       = i;
+    worker->parallel = &parallel;
+  }
+
+  /* A nested call finds the DOM already shared and leaves it so, the 
+   * flag is only written while no other thread is reading it.
+   */
+  shared = jhandle->shared;
+  if (!shared) jhandle->shared = 1;
+
+  /* The calling thread is always worker 0, the runs of any workers we
+   * fail to start are stolen by those that did.
+   */
+  for (started=1; started<threads; started++) {
+    if (pthread_create(&parallel.worker[started].thread, 
+		       (pthread_attr_t *)0, parallel_worker, 
+		       &parallel.worker[started]) != 0) break;
+  }
+
+  (void)parallel_worker(&parallel.worker[0]);
+
+  for (i=1; i<started; i++) {
+    pthread_join(parallel.worker[i].thread, (void **)0);
+  }
+
+  if (!shared) jhandle->shared = 0;
+
+  for (i=0; i<threads; i++) {
+    pthread_mutex_destroy(&parallel.worker[i].lock);
+  }
+  pthread_mutex_destroy(&parallel.lock);
+  free(parallel.worker);
+  if (owned) free(parallel.offset);
+
+  if (parallel.error) {
+    errno = parallel.error;
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
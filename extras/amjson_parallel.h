@@ -0,0 +1,82 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+#ifndef _AMJSON_PARALLEL_H_
+#define _AMJSON_PARALLEL_H_
+
+#include <stddef.h>
+
+#include "amjson.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMJSON_PARALLEL_GRAIN 16  /* Elements a worker takes from its own 
+				   * range at a time */
+
+/* Called once for every element of the array, index is the position of
+ * jobject in the array and worker is the number, from 0 to threads-1, 
+ * of the thread making the call so that results can be gathered per 
+ * worker without locking. Return 0 to continue or !0 to stop.
+ */
+typedef int (*amjson_parallel_fn)(struct jhandle *jhandle, 
+				  struct jobject *jobject,
+				  joff_t index, int worker, void *arg);
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Call a function for every element of an array using a pool
+ *          of worker threads that share the DOM.
+ * jhandle: This is a pointer to an initialised jhandle structure.
+ * array:   Array whose elements are visited.
+ * fn:      Callback invoked for every element, it may be called 
+ *          concurrently from several threads and in any order.
+ * arg:     Opaque pointer passed to fn.
+ * threads: Number of workers, 0 uses one per online CPU.
+ *
+ * Each worker starts with an equal run of the array and takes elements
+ * from the front of it, a worker whose run is exhausted steals the back
+ * half of the run of another. The DOM must not be modified until the
+ * call returns, fn may use the lookup and query functions, the indexes
+ * they already hold are used but no new ones are built.
+ * Return 0 on success and !0 on failure, errno is set to EINVAL if 
+ * array is not an array, ENOMEM if the elements could not be indexed 
+ * or ECANCELED if fn asked to stop.
+ */
+int amjson_parallel_foreach(struct jhandle *jhandle, struct jobject *array,
+			    amjson_parallel_fn fn, void *arg, int threads);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1219 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#define _GNU_SOURCE               /* MAP_ANONYMOUS, MAP_HUGETLB and 
+				   * MADV_HUGEPAGE */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "amjson.h"
+#include "extras/amjson_stats.h"
+#include "extras/amjson_batch.h"
+#include "extras/amjson_pool.h"
+
+/* -------------------------------------------------------------------- */
+
+/* A narrower layout can not hold AMJSON_POOL_KEEP jobjects, it keeps
+ * pools small enough to still be shrunk instead.
+ */
+#define POOL_KEEP ((AMJSON_POOL_KEEP < (JOFF_MAX / AMJSON_POOL_SHRINK))? \
+		   AMJSON_POOL_KEEP:(JOFF_MAX / AMJSON_POOL_SHRINK))
+
+#define COMPACT_UNSEEN JOFF_MAX   /* Map entry for a jobject not yet seen */
+#define DETACH_UNSEEN  JOFF_MAX   /* Map entry for a jobject not yet seen */
+#define DETACH_NONE    (JOFF_MAX-1) /* Map entry for a jobject without text
+				     * in the JSON buffer */
+#define DETACH_EMPTY   (JOFF_MAX-2) /* Map entry for empty text */
+
+struct textrange {
+
+  boff_t offset;                  /* Text in the source arena */
+  boff_t len;
+  boff_t dst;                     /* Where it lands in the new arena */
+};
+
+struct compact {
+
+  struct jhandle   *src;          /* DOM being compacted */
+  struct jhandle   *dst;          /* New pool */
+  joff_t           *map;          /* Source offset to new offset */
+  struct jspan     *span;         /* Spans renumbered for the new pool */
+  joff_t           nspan;
+  joff_t           spancount;
+  struct textrange *range;        /* Reachable text of the string arena */
+  size_t           nrange;
+  size_t           rangecount;
+  int              error;         /* Text could not be recorded */
+};
+
+struct detach_text {
+
+  uint32_t hash;
+  jsize_t  len;
+  boff_t   src;                   /* Text in the JSON buffer */
+  bsize_t  dst;                   /* Where it lands in the new arena */
+};
+
+struct detach {
+
+  struct jhandle     *jhandle;
+  struct detach_text *text;       /* Text to copy out of the buffer */
+  joff_t             ntext;
+  joff_t             textcount;
+  joff_t             *table;      /* Short text by hash, entry index + 1 */
+  size_t             tablesize;
+  size_t             nhashed;
+  bsize_t            total;       /* Bytes of text to copy */
+};
+
+struct dedupe_entry {
+
+  uint32_t hash;
+  joff_t   node;                  /* Container holding the shared list, 
+				   * COMPACT_UNSEEN when empty */
+};
+
+struct dedupe {
+
+  struct jhandle      *jhandle;
+  struct dedupe_entry *entry;     /* Open addressed by hash */
+  size_t              size;
+  size_t              count;
+  int                 error;
+};
+
+struct cache {
+
+  struct jhandle      *handle[AMJSON_POOL_HANDLES];
+  unsigned int        nhandle;    /* Idle handles held */
+  struct amjson_stats stats;      /* Sizes of recent decodes */
+};
+
+/* -------------------------------------------------------------------- */
+
+static pthread_key_t  cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static int            cache_error;
+
+/* -------------------------------------------------------------------- */
+
+extern struct jobject *jobject_allocate(struct jhandle *jhandle, joff_t count);
+extern char *jstring_allocate(struct jhandle *jhandle, bsize_t len);
+extern int jobject_reserve(struct jhandle *jhandle, joff_t count);
+extern int jobject_shrink(struct jhandle *jhandle);
+extern struct jspan *jspan_find(struct jhandle *jhandle, struct jobject *jobject);
+extern void jindex_clear(struct jhandle *jhandle);
+extern uint32_t jindex_keyhash(char *ptr, jsize_t len);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static int compact_text(struct compact *c, struct jobject *jobject);
+static int compact_text_cmp(const void *a, const void *b);
+static int compact_arena(struct compact *c);
+static boff_t compact_text_map(struct compact *c, boff_t offset);
+static joff_t compact_count(struct compact *c, joff_t offset);
+static int compact_copy(struct compact *c, joff_t offset, joff_t *head);
+static int compact_span(struct compact *c, struct jobject *jobject, 
+			joff_t node);
+static int compact_span_cmp(const void *a, const void *b);
+static int detach_grow(struct detach *d);
+static int detach_text(struct detach *d, struct jobject *jobject, 
+		       joff_t *index);
+static int detach_walk(struct detach *d, joff_t *map, joff_t offset);
+static int detach_roots(struct jhandle *jhandle, struct jdoc *doc, 
+			size_t count);
+static uint32_t dedupe_mix(uint32_t hash, uint32_t value);
+static uint32_t dedupe_hash(struct jhandle *jhandle, struct jobject *jobject);
+static int dedupe_same(struct jhandle *jhandle, struct jobject *a, 
+		       struct jobject *b);
+static int dedupe_grow(struct dedupe *d);
+static void dedupe_node(struct dedupe *d, struct jobject *jobject);
+static void cache_create(void);
+static void cache_destroy(void *arg);
+static struct cache *cache_get(void);
+static void *hugepage_map(size_t size);
+static void *hugepage_alloc(void *ctx, size_t size);
+static void *hugepage_resize(void *ctx, void *ptr, size_t oldsize, 
+			     size_t size);
+static void hugepage_release(void *ctx, void *ptr, size_t size);
+
+/* -------------------------------------------------------------------- */
+
+static struct jallocator hugepage = {
+  hugepage_alloc, hugepage_resize, hugepage_release, (void *)0
+};
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_text(struct compact *c, struct jobject *jobject) {
+
+  /* Note the text of a constructed string, interned keys share their 
+   * text so the ranges are merged once they have all been seen.
+   */
+  if (!(jobject->blen & AMJSON_STRBUFMASK)) return 0;
+  if (JOBJECT_STRING_LEN(jobject) == 0) return 0;
+
+  if (c->nrange == c->rangecount) {
+
+    void *ptr;
+    size_t ncount = (c->rangecount == 0)?64:(c->rangecount * 2);
+
+    if (ncount <= c->rangecount) return -1; /* overflow */
+
+    ptr = realloc(c->range, (ncount * sizeof(struct textrange)));
+    if (!ptr) return -1;
+
+    c->rangecount = ncount;
+    c->range      = (struct textrange *)ptr;
+  }
+
+  c->range[c->nrange].offset = jobject->u.string.offset;
+  c->range[c->nrange].len    = JOBJECT_STRING_LEN(jobject);
+  c->nrange++;
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_text_cmp(const void *a, const void *b) {
+
+  boff_t oa = ((const struct textrange *)a)->offset;
+  boff_t ob = ((const struct textrange *)b)->offset;
+
+  return (oa < ob)?-1:((oa > ob)?1:0);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_arena(struct compact *c) {
+
+  /* Merge the overlapping ranges and copy them, back to back, into an 
+   * arena of exactly the right size.
+   */
+  bsize_t total = 0;
+  size_t i, n = 0;
+  char *ptr;
+
+  if (c->nrange == 0) return 0;
+
+  qsort(c->range, c->nrange, sizeof(struct textrange), compact_text_cmp);
+
+  for (i=0; i<c->nrange; i++) {
+
+    struct textrange *r = &c->range[i];
+
+    if (n && (r->offset <= 
+	      (c->range[n-1].offset + c->range[n-1].len))) {
+
+      struct textrange *m = &c->range[n-1];
+      boff_t end = r->offset + r->len;
+
+      if (end > (m->offset + m->len)) {
+	total  += end - (m->offset + m->len);
+	m->len  = end - m->offset;
+      }
+      continue;
+    }
+
+    c->range[n]     = *r;
+    c->range[n].dst = total;
+    total          += r->len;
+    n++;
+  }
+  c->nrange = n;
+
+  if (!(ptr = jstring_allocate(c->dst, total))) return -1;
+
+  for (i=0; i<c->nrange; i++) {
+    memcpy(&ptr[c->range[i].dst], &c->src->text[c->range[i].offset], 
+	   c->range[i].len);
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static boff_t compact_text_map(struct compact *c, boff_t offset) {
+
+  /* Find the merged range holding the text */
+  size_t lo = 0, hi = c->nrange;
+
+  while ((hi - lo) > 1) {
+
+    size_t mid = lo + ((hi - lo) / 2);
+
+    if (c->range[mid].offset <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return c->range[lo].dst + (offset - c->range[lo].offset);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static joff_t compact_count(struct compact *c, joff_t offset) {
+
+  /* Count the jobjects reachable from a list, each one is marked in the
+   * map so that shared jobjects are only counted once.
+   */
+  joff_t count = 0;
+
+  for (;;) {
+
+    struct jobject *jobject = JOBJECT_AT(c->src, offset);
+    unsigned int type = jobject->blen >> AMJSON_LENBITS;
+
+    if (c->map[offset] != COMPACT_UNSEEN) break;
+    c->map[offset] = 0;
+    count++;
+
+    if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) {
+      if (OBJECT_COUNT(jobject)) {
+	count += compact_count(c, jobject->u.object.child);
+      }
+    } else if (compact_text(c, jobject) != 0) {
+      c->error = 1;
+    }
+
+    if (jobject->next == AMJSON_INVALID) break;
+    offset = jobject->next;
+  }
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_copy(struct compact *c, joff_t offset, joff_t *head) {
+
+  /* Copy a list depth first so each container is followed by all of its
+   * contents, a list that joins one already copied is linked to it.
+   */
+  joff_t prev = COMPACT_UNSEEN;
+
+  for (;;) {
+
+    struct jobject *jobject = JOBJECT_AT(c->src, offset);
+    unsigned int type = jobject->blen >> AMJSON_LENBITS;
+    struct jobject *copy;
+    joff_t node = c->map[offset];
+
+    if (node != COMPACT_UNSEEN) {
+      if (prev == COMPACT_UNSEEN) {
+	*head = node;
+      } else {
+	JOBJECT_AT(c->dst, prev)->next = node;
+      }
+      break;
+    }
+
+    if (!(copy = jobject_allocate(c->dst, 1))) return -1;
+    node           = c->dst->used - 1;
+    c->map[offset] = node;
+      
+    copy->blen = jobject->blen;
+    copy->u    = jobject->u;
+    copy->next = AMJSON_INVALID;
+
+    if (prev == COMPACT_UNSEEN) {
+      *head = node;
+    } else {
+      JOBJECT_AT(c->dst, prev)->next = node;
+    }
+
+    if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) {
+      if (OBJECT_COUNT(jobject)) {
+
+	joff_t child;
+
+	if (compact_copy(c, jobject->u.object.child, &child) != 0) return -1;
+	JOBJECT_AT(c->dst, node)->u.object.child = child;
+      }
+      if (compact_span(c, jobject, node) != 0) return -1;
+
+    } else if (jobject->blen & AMJSON_STRBUFMASK) {
+
+      /* Empty text occupies no space, point it somewhere valid */
+      JOBJECT_AT(c->dst, node)->u.string.offset = 
+	(JOBJECT_STRING_LEN(jobject) == 0)?0:
+	compact_text_map(c, jobject->u.string.offset);
+    }
+
+    if (jobject->next == AMJSON_INVALID) break;
+    prev   = node;
+    offset = jobject->next;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_span(struct compact *c, struct jobject *jobject, 
+			joff_t node) {
+
+  /* The container and everything copied after it form its new range */
+  struct jspan *span;
+
+  if (c->src->nspan == 0) return 0;
+  if (!(span = jspan_find(c->src, jobject))) return 0;
+
+  if (c->nspan == c->spancount) {
+
+    void *ptr;
+    joff_t ncount = (c->spancount == 0)?64:(c->spancount * 2);
+
+    if (ncount <= c->spancount) return -1; /* overflow */
+
+    ptr = realloc(c->span, (ncount * sizeof(struct jspan)));
+    if (!ptr) return -1;
+
+    c->spancount = ncount;
+    c->span      = (struct jspan *)ptr;
+  }
+
+  c->span[c->nspan]           = *span;
+  c->span[c->nspan].node      = node;
+  c->span[c->nspan].first     = node;
+  c->span[c->nspan].last      = c->dst->used - 1;
+  c->span[c->nspan].scattered = 0;
+
+  /* The parent was copied before its contents */
+  c->span[c->nspan].parent    = 
+    ((span->parent == span->node) || 
+     (c->map[span->parent] == COMPACT_UNSEEN))?node:c->map[span->parent];
+  c->nspan++;
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int compact_span_cmp(const void *a, const void *b) {
+
+  joff_t na = ((const struct jspan *)a)->node;
+  joff_t nb = ((const struct jspan *)b)->node;
+
+  return (na < nb)?-1:((na > nb)?1:0);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_compact(struct jhandle *jhandle) {
+
+  struct jhandle dst;
+  struct compact c;
+  joff_t count;
+  joff_t root;
+  joff_t i;
+
+  /* The root of a compacted DOM is offset 0, which reads as 
+   * AMJSON_INVALID, so an empty pool is what marks there being no DOM.
+   */
+  if (jhandle->used == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&c, 0, sizeof(struct compact));
+  c.src = jhandle;
+  c.dst = &dst;
+  
+  if (!(c.map = (joff_t *)malloc((size_t)jhandle->used * sizeof(joff_t)))) {
+    goto error;
+  }
+
+  /* Size the new pool exactly, then copy into it */
+  for (i=0; i<jhandle->used; i++) c.map[i] = COMPACT_UNSEEN;
+  count = compact_count(&c, jhandle->root);
+  for (i=0; i<jhandle->used; i++) c.map[i] = COMPACT_UNSEEN;
+
+  if (c.error) goto error;
+
+  if (amjson_alloc_ex(&dst, (struct jobject *)0, count, 
+		      jhandle->allocator) != 0) goto error;
+
+  if ((compact_arena(&c) != 0) ||
+      (compact_copy(&c, jhandle->root, &root) != 0)) {
+    amjson_free(&dst);
+    goto error;
+  }
+  free(c.map);
+  free(c.range);
+
+  /* The count is exact but slabs come in whole sizes, trim the slack.
+   * Should that fail the pool is merely larger than it needs to be.
+   */
+  (void)jobject_shrink(&dst);
+
+  /* Containers are finished after their contents, so the spans arrive
+   * out of order. Without spans there is nothing to sort.
+   */
+  if (c.nspan) {
+    qsort(c.span, c.nspan, sizeof(struct jspan), compact_span_cmp);
+  }
+
+  /* Swap the new pool and spans into the context */
+  dst.span      = c.span;
+  dst.nspan     = c.nspan;
+  dst.spancount = c.spancount;
+
+  amjson_free(jhandle);
+  jhandle->userbuffer = 0;
+
+#ifdef AMJSON_SLABPOOL
+  jhandle->slab      = dst.slab;
+  jhandle->nslab     = dst.nslab;
+  jhandle->slabcount = dst.slabcount;
+  jhandle->slabhint  = 0;
+  jhandle->shift     = dst.shift;
+  jhandle->mask      = dst.mask;
+  jhandle->holestart = dst.holestart;
+  jhandle->holeend   = dst.holeend;
+#endif
+  jhandle->jobject   = dst.jobject;
+  jhandle->count     = dst.count;
+  jhandle->used      = dst.used;
+  jhandle->root      = root;
+  jhandle->span      = dst.span;
+  jhandle->nspan     = dst.nspan;
+  jhandle->spancount = dst.spancount;
+
+  jhandle->text       = dst.text;
+  jhandle->textused   = dst.textused;
+  jhandle->textsize   = dst.textsize;
+  jhandle->textshared = dst.textused;  /* Text may still be shared */
+
+  return 0;
+
+ error:
+  free(c.map);
+  free(c.span);
+  free(c.range);
+  errno = ENOMEM;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int detach_grow(struct detach *d) {
+
+  size_t size = (d->tablesize == 0)?256:(d->tablesize * 2);
+  joff_t *table;
+  size_t i;
+
+  if (size <= d->tablesize) return -1; /* overflow */
+
+  table = (joff_t *)calloc(size, sizeof(joff_t));
+  if (!table) return -1;
+
+  for (i=0; i<d->tablesize; i++) {
+
+    size_t j;
+
+    if (!d->table[i]) continue;
+
+    for (j = d->text[d->table[i]-1].hash & (size-1); table[j]; 
+	 j = (j+1) & (size-1));
+    table[j] = d->table[i];
+  }
+
+  free(d->table);
+  d->table     = table;
+  d->tablesize = size;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int detach_text(struct detach *d, struct jobject *jobject, 
+		       joff_t *index) {
+
+  /* Find a place in the new arena for the text of a jobject. Short text
+   * such as keys repeats often and is shared, longer text is copied as
+   * it is found.
+   */
+  char *ptr = JOBJECT_STRING_PTR(d->jhandle, jobject);
+  jsize_t len = JOBJECT_STRING_LEN(jobject);
+  uint32_t hash = 0;
+  size_t i = 0;
+
+  if (len == 0) {
+    *index = DETACH_EMPTY;
+    return 0;
+  }
+
+  if (len <= AMJSON_DETACH_SHARE) {
+
+    if (((d->nhashed + 1) * 2) > d->tablesize) {
+      if (detach_grow(d) != 0) return -1;
+    }
+
+    hash = jindex_keyhash(ptr, len);
+
+    for (i = hash & (d->tablesize-1); d->table[i]; 
+	 i = (i+1) & (d->tablesize-1)) {
+
+      struct detach_text *text = &d->text[d->table[i]-1];
+
+      if ((text->hash == hash) && (text->len == len) &&
+	  (memcmp(&d->jhandle->buf[text->src], ptr, len) == 0)) {
+	*index = d->table[i]-1;
+	return 0;
+      }
+    }
+  }
+
+  if (d->ntext == d->textcount) {
+
+    void *nptr;
+    joff_t ncount = (d->textcount == 0)?256:(d->textcount * 2);
+
+    if (ncount <= d->textcount) return -1; /* overflow */
+
+    nptr = realloc(d->text, (ncount * sizeof(struct detach_text)));
+    if (!nptr) return -1;
+
+    d->textcount = ncount;
+    d->text      = (struct detach_text *)nptr;
+  }
+
+  if ((d->total + len) < d->total) return -1; /* overflow */
+
+  d->text[d->ntext].hash = hash;
+  d->text[d->ntext].len  = len;
+  d->text[d->ntext].src  = jobject->u.string.offset;
+  d->text[d->ntext].dst  = d->total;
+  d->total += len;
+
+  if (len <= AMJSON_DETACH_SHARE) {
+    d->table[i] = d->ntext + 1;
+    d->nhashed++;
+  }
+
+  *index = d->ntext++;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int detach_walk(struct detach *d, joff_t *map, joff_t offset) {
+
+  /* Visit a list and everything reachable from it, each jobject is 
+   * marked in the map so that shared lists are only visited once.
+   */
+  for (;;) {
+
+    struct jobject *jobject = JOBJECT_AT(d->jhandle, offset);
+    unsigned int type = jobject->blen >> AMJSON_LENBITS;
+
+    if (map[offset] != DETACH_UNSEEN) break;
+    map[offset] = DETACH_NONE;
+
+    if ((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) {
+      if (OBJECT_COUNT(jobject)) {
+	if (detach_walk(d, map, jobject->u.object.child) != 0) return -1;
+      }
+    } else if (!(jobject->blen & AMJSON_STRBUFMASK)) {
+      if (detach_text(d, jobject, &map[offset]) != 0) return -1;
+    }
+
+    if (jobject->next == AMJSON_INVALID) break;
+    offset = jobject->next;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int detach_roots(struct jhandle *jhandle, struct jdoc *doc, 
+			size_t count) {
+
+  /* Detach what is reachable from each decoded document of a batch, or
+   * from the root when there is no batch. Jobjects left behind by
+   * amjson_reparse() may refer to text that is no longer in the buffer
+   * and are never visited.
+   */
+  struct jhandle dst;
+  struct detach d;
+  joff_t *map = (joff_t *)0;
+  bsize_t size;
+  char *ptr = (char *)0;
+  joff_t i;
+
+  memset(&d, 0, sizeof(struct detach));
+  d.jhandle = jhandle;
+
+  if (jhandle->used) {
+
+    map = (joff_t *)malloc((size_t)jhandle->used * sizeof(joff_t));
+    if (!map) goto error;
+
+    for (i=0; i<jhandle->used; i++) map[i] = DETACH_UNSEEN;
+
+    if (!doc) {
+      if (detach_walk(&d, map, jhandle->root) != 0) goto error;
+    } else {
+
+      size_t n;
+
+      for (n=0; n<count; n++) {
+	if (doc[n].error) continue;
+	if (detach_walk(&d, map, doc[n].root) != 0) goto error;
+      }
+    }
+  }
+
+  /* Text already in the arena is kept in front of the copied text, the
+   * new arena is allocated at the size required.
+   */
+  size = jhandle->textused + d.total;
+  if (size < d.total) goto error; /* overflow */
+
+  memset(&dst, 0, sizeof(struct jhandle));
+  dst.allocator = jhandle->allocator;
+
+  if (size) {
+
+    if (!(ptr = jstring_allocate(&dst, size))) goto error;
+
+    if (jhandle->textused) memcpy(ptr, jhandle->text, jhandle->textused);
+
+    for (i=0; i<d.ntext; i++) {
+      memcpy(&ptr[jhandle->textused + d.text[i].dst], 
+	     &jhandle->buf[d.text[i].src], d.text[i].len);
+    }
+  }
+
+  /* Nothing can fail now, point the jobjects at their new text */
+  for (i=0; i<jhandle->used; i++) {
+
+    struct jobject *jobject;
+
+    if ((map[i] == DETACH_UNSEEN) || (map[i] == DETACH_NONE)) continue;
+
+    jobject = JOBJECT_AT(jhandle, i);
+    jobject->blen |= AMJSON_STRBUFMASK;
+    jobject->u.string.offset = (map[i] == DETACH_EMPTY)?0:
+      (jhandle->textused + d.text[map[i]].dst);
+  }
+
+  free(map);
+  free(d.text);
+  free(d.table);
+
+  /* Release the old arena with the context's allocator */
+  ptr  = jhandle->text;
+  size = jhandle->textsize;
+
+  jhandle->text       = dst.text;
+  jhandle->textused   = dst.textused;
+  jhandle->textsize   = dst.textsize;
+  jhandle->textshared = dst.textused;  /* Short text is now shared */
+
+  dst.text     = ptr;
+  dst.textsize = size;
+  amjson_free(&dst);
+
+  /* Spans locate containers in the buffer, they are of no further use */
+  jhandle->nspan     = 0;
+  jhandle->deadspans = 0;
+  jhandle->buf       = (char *)0;
+  jhandle->eptr      = (char *)0;
+  jhandle->len       = 0;
+
+  return 0;
+
+ error:
+  free(map);
+  free(d.text);
+  free(d.table);
+  errno = ENOMEM;
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_detach(struct jhandle *jhandle) {
+
+  return detach_roots(jhandle, (struct jdoc *)0, 0);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_detach_batch(struct jhandle *jhandle, struct jdoc *doc, 
+			size_t count) {
+
+  return detach_roots(jhandle, doc, count);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static uint32_t dedupe_mix(uint32_t hash, uint32_t value) {
+
+  /* Combine a value into the hash, the order of values matters */
+  return hash ^ (value + 0x9e3779b9U + (hash << 6) + (hash >> 2));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static uint32_t dedupe_hash(struct jhandle *jhandle, struct jobject *jobject) {
+
+  /* Hash a container from its children. Lists below it have already 
+   * been replaced by shared ones, so a child container is identified by
+   * the offset of its list and only text needs to be read.
+   */
+  uint32_t hash = dedupe_mix(0, (uint32_t)jobject->blen);
+  joff_t next = jobject->u.object.child;
+
+  do {
+
+    struct jobject *child = JOBJECT_AT(jhandle, next);
+    unsigned int type = child->blen >> AMJSON_LENBITS;
+
+    if ((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) {
+
+      jsize_t len = JOBJECT_STRING_LEN(child);
+
+      hash = dedupe_mix(hash, (uint32_t)(type | (len << 2)));
+      hash = dedupe_mix(hash, 
+			jindex_keyhash(JOBJECT_STRING_PTR(jhandle, child), len));
+
+    } else {
+      hash = dedupe_mix(hash, (uint32_t)child->blen);
+      hash = dedupe_mix(hash, (uint32_t)child->u.object.child);
+    }
+
+    next = child->next;
+
+  } while (next != AMJSON_INVALID);
+
+  return hash;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int dedupe_same(struct jhandle *jhandle, struct jobject *a, 
+		       struct jobject *b) {
+
+  /* Both containers have the same blen and at least one child */
+  joff_t na = a->u.object.child;
+  joff_t nb = b->u.object.child;
+
+  if (na == nb) return 1;
+
+  do {
+
+    struct jobject *ca = JOBJECT_AT(jhandle, na);
+    struct jobject *cb = JOBJECT_AT(jhandle, nb);
+    unsigned int type = ca->blen >> AMJSON_LENBITS;
+
+    if (type != (unsigned int)(cb->blen >> AMJSON_LENBITS)) return 0;
+
+    if ((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) {
+
+      /* Text may live in the buffer or the arena */
+      if (JOBJECT_STRING_LEN(ca) != JOBJECT_STRING_LEN(cb)) return 0;
+      if (memcmp(JOBJECT_STRING_PTR(jhandle, ca), 
+		 JOBJECT_STRING_PTR(jhandle, cb),
+		 JOBJECT_STRING_LEN(ca)) != 0) return 0;
+
+    } else if ((ca->blen != cb->blen) || 
+	       (ca->u.object.child != cb->u.object.child)) {
+      return 0;
+    }
+
+    na = ca->next;
+    nb = cb->next;
+
+  } while (na != AMJSON_INVALID);
+
+  return 1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int dedupe_grow(struct dedupe *d) {
+
+  size_t size = (d->size == 0)?1024:(d->size * 2);
+  struct dedupe_entry *entry;
+  size_t i;
+
+  if (size <= d->size) return -1; /* overflow */
+
+  entry = (struct dedupe_entry *)malloc(size * sizeof(struct dedupe_entry));
+  if (!entry) return -1;
+
+  for (i=0; i<size; i++) entry[i].node = COMPACT_UNSEEN;
+
+  for (i=0; i<d->size; i++) {
+
+    size_t j;
+
+    if (d->entry[i].node == COMPACT_UNSEEN) continue;
+
+    for (j = d->entry[i].hash & (size-1); entry[j].node != COMPACT_UNSEEN;
+	 j = (j+1) & (size-1));
+    entry[j] = d->entry[i];
+  }
+
+  free(d->entry);
+  d->entry = entry;
+  d->size  = size;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void dedupe_node(struct dedupe *d, struct jobject *jobject) {
+
+  /* Share the lists of the containers below first, then look for a
+   * container already seen with the same contents and share its list.
+   */
+  struct jhandle *jhandle = d->jhandle;
+  uint32_t hash;
+  joff_t next;
+  size_t i;
+
+  next = jobject->u.object.child;
+  do {
+
+    struct jobject *child = JOBJECT_AT(jhandle, next);
+    unsigned int type = child->blen >> AMJSON_LENBITS;
+
+    if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) &&
+	(OBJECT_COUNT(child))) {
+      dedupe_node(d, child);
+    }
+    next = child->next;
+
+  } while (next != AMJSON_INVALID);
+
+  if (d->error) return;
+
+  if (((d->count + 1) * 2) > d->size) {
+    if (dedupe_grow(d) != 0) {
+      d->error = 1;
+      return;
+    }
+  }
+
+  hash = dedupe_hash(jhandle, jobject);
+
+  for (i = hash & (d->size-1); d->entry[i].node != COMPACT_UNSEEN; 
+       i = (i+1) & (d->size-1)) {
+
+    struct jobject *seen = JOBJECT_AT(jhandle, d->entry[i].node);
+
+    if ((d->entry[i].hash == hash) && (seen->blen == jobject->blen) &&
+	(dedupe_same(jhandle, seen, jobject))) {
+
+      jobject->u.object.child = seen->u.object.child;
+      return;
+    }
+  }
+
+  d->entry[i].hash = hash;
+  d->entry[i].node = JOBJECT_OFFSET(jhandle, jobject);
+  d->count++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_dedupe(struct jhandle *jhandle) {
+
+  struct jobject *root;
+  struct dedupe d;
+  unsigned int type;
+
+  if (jhandle->used == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&d, 0, sizeof(struct dedupe));
+  d.jhandle = jhandle;
+
+  root = JOBJECT_ROOT(jhandle);
+  type = root->blen >> AMJSON_LENBITS;
+
+  if (((type == AMJSON_OBJECT) || (type == AMJSON_ARRAY)) && 
+      (OBJECT_COUNT(root))) {
+    dedupe_node(&d, root);
+  }
+
+  free(d.entry);
+
+  /* Indexes name the jobjects of lists that are no longer linked, and a
+   * reparse would release a list that is still shared.
+   */
+  jindex_clear(jhandle);
+  jhandle->nspan     = 0;
+  jhandle->deadspans = 0;
+
+  /* Each list is swapped whole, whatever was shared before running out
+   * of memory is still a valid DOM.
+   */
+  if (d.error) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void cache_create(void) {
+
+  cache_error = pthread_key_create(&cache_key, cache_destroy);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void cache_destroy(void *arg) {
+
+  /* Called as a thread exits with its cache */
+  struct cache *cache = (struct cache *)arg;
+  unsigned int i;
+
+  for (i=0; i<cache->nhandle; i++) {
+    amjson_free(cache->handle[i]);
+    free(cache->handle[i]);
+  }
+  free(cache);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct cache *cache_get(void) {
+
+  struct cache *cache;
+
+  if ((pthread_once(&cache_once, cache_create) != 0) || (cache_error)) {
+    return (struct cache *)0;
+  }
+
+  if ((cache = (struct cache *)pthread_getspecific(cache_key))) {
+    return cache;
+  }
+
+  if (!(cache = (struct cache *)malloc(sizeof(struct cache)))) {
+    return (struct cache *)0;
+  }
+  cache->nhandle = 0;
+  amjson_stats_init(&cache->stats, AMJSON_POOL_PERCENTILE);
+
+  if (pthread_setspecific(cache_key, cache) != 0) {
+    free(cache);
+    return (struct cache *)0;
+  }
+
+  return cache;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jhandle *amjson_handle_get(bsize_t len) {
+
+  struct cache *cache;
+  struct jhandle *jhandle;
+  joff_t count;
+
+  if (!(cache = cache_get())) goto error;
+
+  count = amjson_stats_guess(&cache->stats, len);
+
+  if (cache->nhandle == 0) {
+
+    if (!(jhandle = (struct jhandle *)malloc(sizeof(struct jhandle)))) {
+      goto error;
+    }
+    if (amjson_alloc(jhandle, (struct jobject *)0, count) != 0) {
+      free(jhandle);
+      goto error;
+    }
+    return jhandle;
+  }
+
+  jhandle = cache->handle[--cache->nhandle];
+  amjson_reset(jhandle);
+
+  /* A pool that grew for one unusually large document is given back 
+   * rather than kept for ever.
+   */
+  if ((jhandle->count > POOL_KEEP) && 
+      ((jhandle->count / AMJSON_POOL_SHRINK) > count)) {
+
+    int usespans = jhandle->usespans;
+
+    amjson_free(jhandle);
+    if (amjson_alloc(jhandle, (struct jobject *)0, count) != 0) {
+      free(jhandle);
+      goto error;
+    }
+    amjson_record_spans(jhandle, usespans);
+    return jhandle;
+  }
+
+  /* Growing now means decoding will not have to, a short pool still
+   * grows as usual so failure here is not fatal.
+   */
+  (void)jobject_reserve(jhandle, count);
+  return jhandle;
+
+ error:
+  errno = ENOMEM;
+  return (struct jhandle *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_handle_put(struct jhandle *jhandle) {
+
+  struct cache *cache = cache_get();
+
+  if (!cache) {
+    amjson_free(jhandle);
+    free(jhandle);
+    return;
+  }
+
+  /* A compacted root may be offset 0, any decode leaves the pool used */
+  if ((jhandle->used != 0) && (jhandle->len)) {
+    amjson_stats_record(&cache->stats, jhandle->len, jhandle->used);
+  }
+
+  if (cache->nhandle == AMJSON_POOL_HANDLES) {
+    amjson_free(jhandle);
+    free(jhandle);
+    return;
+  }
+
+  cache->handle[cache->nhandle++] = jhandle;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *hugepage_map(size_t size) {
+
+  /* Explicit huge pages need to have been reserved by the administrator,
+   * without them ask for transparent huge pages. Those are only used 
+   * for 2MB aligned ranges so map more than is needed and trim it.
+   */
+  char *ptr;
+  char *aptr;
+  size_t len = size + AMJSON_HUGEPAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+  ptr = (char *)mmap((void *)0, size, PROT_READ|PROT_WRITE, 
+		     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  if (ptr != (char *)MAP_FAILED) return ptr;
+#endif
+
+  ptr = (char *)mmap((void *)0, len, PROT_READ|PROT_WRITE, 
+		     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (ptr == (char *)MAP_FAILED) return (void *)0;
+
+  aptr = (char *)(((uintptr_t)ptr + AMJSON_HUGEPAGE_SIZE - 1) & 
+		  ~((uintptr_t)AMJSON_HUGEPAGE_SIZE - 1));
+
+  if (aptr != ptr) (void)munmap(ptr, aptr - ptr);
+  (void)munmap(aptr + size, AMJSON_HUGEPAGE_SIZE - (aptr - ptr));
+
+#ifdef MADV_HUGEPAGE
+  (void)madvise(aptr, size, MADV_HUGEPAGE);
+#endif
+
+  return aptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *hugepage_alloc(void *ctx __attribute__((unused)), 
+			    size_t size) {
+
+  /* Only allocations of a huge page or more are mapped, they are 
+   * rounded up to whole huge pages.
+   */
+  if (size < AMJSON_HUGEPAGE_SIZE) return malloc(size);
+
+  return hugepage_map((size + AMJSON_HUGEPAGE_SIZE - 1) & 
+		      ~((size_t)AMJSON_HUGEPAGE_SIZE - 1));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void *hugepage_resize(void *ctx, void *ptr, size_t oldsize, 
+			     size_t size) {
+
+  void *nptr;
+
+  if (!ptr) return hugepage_alloc(ctx, size);
+
+  if ((oldsize < AMJSON_HUGEPAGE_SIZE) && (size < AMJSON_HUGEPAGE_SIZE)) {
+    return realloc(ptr, size);
+  }
+
+  if (!(nptr = hugepage_alloc(ctx, size))) return (void *)0;
+
+  memcpy(nptr, ptr, (oldsize < size)?oldsize:size);
+  hugepage_release(ctx, ptr, oldsize);
+  return nptr;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void hugepage_release(void *ctx __attribute__((unused)), 
+			     void *ptr, size_t size) {
+
+  if (size < AMJSON_HUGEPAGE_SIZE) {
+    free(ptr);
+    return;
+  }
+
+  (void)munmap(ptr, (size + AMJSON_HUGEPAGE_SIZE - 1) & 
+	       ~((size_t)AMJSON_HUGEPAGE_SIZE - 1));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jallocator *amjson_hugepage_allocator(void) {
+
+  return &hugepage;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
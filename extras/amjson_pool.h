@@ -0,0 +1,167 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMJSON_POOL_H_
+#define _AMJSON_POOL_H_
+
+#include "amjson.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMJSON_POOL_HANDLES    4      /* Idle handles cached per thread */
+#define AMJSON_POOL_PERCENTILE 95     /* Percentile of recent decodes a 
+				       * cached handle is sized for */
+#define AMJSON_POOL_KEEP       65536  /* Pools of up to this many jobjects
+				       * are never shrunk */
+#define AMJSON_POOL_SHRINK     4      /* Larger pools are shrunk once they
+				       * are this many times the estimate */
+#define AMJSON_HUGEPAGE_SIZE   (2UL*1024*1024) /* Huge page size */
+#define AMJSON_DETACH_SHARE    64     /* Text up to this length is copied 
+				       * once by amjson_detach() however
+				       * often it appears */
+
+/* -------------------------------------------------------------------- */
+
+struct jdoc;                          /* See extras/amjson_batch.h */
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Copy the DOM reachable from the root into a new pool that is
+ *          just large enough to hold it and release the old pool.
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded DOM.
+ *
+ * Jobjects are laid out in the order they are visited, each container
+ * followed by its contents, and anything no longer reachable such as
+ * values replaced by amjson_update() is dropped. Jobjects reachable 
+ * from more than one place remain shared. The root becomes offset 0, 
+ * every other offset and every pointer into the old pool is invalid 
+ * once this returns. A user supplied pool is left for the caller to 
+ * release, the context then owns the new pool.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOMEM if the new pool could not be
+ * allocated, the DOM is then left as it was.
+ */
+int amjson_compact(struct jhandle *jhandle);
+
+/* Summary: Copy the text of every string and number still found in the
+ *          JSON buffer into the context, so that the buffer can be 
+ *          released while the DOM is kept.
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded DOM.
+ *
+ * The text is copied into the string arena of the context, and text of
+ * up to AMJSON_DETACH_SHARE bytes that appears more than once is stored
+ * once. Only jobjects reachable from the root are detached, use 
+ * amjson_detach_batch() for the documents of a batch. Spans are 
+ * dropped, so amjson_reparse() decodes the next buffer in full and 
+ * amjson_dump() writes out every container. Jobject offsets and 
+ * pointers are unchanged.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOMEM on failure, the DOM is then 
+ * left as it was.
+ */
+int amjson_detach(struct jhandle *jhandle);
+
+/* Summary: Detach every document decoded by amjson_decode_batch().
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded batch.
+ * doc:     Array of documents as filled in by amjson_decode_batch(), 
+ *          documents whose error is not 0 are skipped.
+ * count:   Count of documents in the array.
+ *
+ * As amjson_detach() but the text reachable from the root of each 
+ * decoded document is copied.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOMEM on failure, the DOM is then 
+ * left as it was.
+ */
+int amjson_detach_batch(struct jhandle *jhandle, struct jdoc *doc, 
+			size_t count);
+
+/* Summary: Find objects and arrays with identical contents and have 
+ *          them all refer to a single copy of those contents.
+ * jhandle: This is a pointer to an initialised jhandle structure holding
+ *          a decoded DOM.
+ *
+ * Containers are compared bottom up, keys and values must match in 
+ * order and text must match byte for byte. Every container keeps its
+ * own jobject but duplicates share one list of children, so two shared
+ * containers compare equal by the offset of that list. The DOM must be
+ * treated as read only afterwards, modifying a shared list changes it
+ * everywhere it appears. Spans are dropped so amjson_reparse() decodes
+ * the whole buffer again. Call amjson_compact() afterwards to drop the 
+ * lists no longer referenced and shrink the pool.
+ * Return 0 on success and !0 on failure.
+ * The value of errno will be set to ENOMEM on failure, the DOM is then
+ * still valid but may be only partly shared.
+ */
+int amjson_dedupe(struct jhandle *jhandle);
+
+/* Summary: Take an amjson context from the calling thread's cache, ready
+ *          to decode a JSON buffer.
+ * len:     This is the length of the JSON buffer that will be decoded.
+ *
+ * The pool is sized from the decodes recently returned to the cache by
+ * this thread, once the cache is warm no memory is allocated. The 
+ * context must be given back with amjson_handle_put() on the same 
+ * thread, not released with amjson_free(). Cached contexts are freed
+ * when the thread exits.
+ * Return a pointer to the context or (struct jhandle *)0 on failure.
+ * The value of errno will be set to ENOMEM on failure.
+ */
+struct jhandle *amjson_handle_get(bsize_t len);
+
+/* Summary: Give a context taken with amjson_handle_get() back to the
+ *          calling thread's cache, its DOM is discarded.
+ * jhandle: This is a pointer to a jhandle returned by amjson_handle_get().
+ */
+void amjson_handle_put(struct jhandle *jhandle);
+
+/* Summary: Return an allocator for amjson_alloc_ex() that backs large 
+ *          pools with huge pages to reduce TLB misses when decoding and
+ *          walking very large documents.
+ *
+ * Allocations of AMJSON_HUGEPAGE_SIZE or more are mapped with 
+ * MAP_HUGETLB, falling back to transparent huge pages requested with 
+ * madvise(MADV_HUGEPAGE) when none are reserved. Smaller allocations
+ * use malloc().
+ */
+struct jallocator *amjson_hugepage_allocator(void);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
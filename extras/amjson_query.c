@@ -23,15 +23,168 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  * -------------------------------------------------------------------- */
 
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
 #include "amjson.h"
 #include "extras/amjson_query.h"
 #include "extras/amjson_util.h"
 
+/* -------------------------------------------------------------------- */
+
+#define QUERY_KEY      0          /* Member of an object */
+#define QUERY_INDEX    1          /* Element of an array */
+#define QUERY_POINTER  2          /* JSON Pointer reference token, a member
+				   * or an element depending on what it is
+				   * applied to */
+#define QUERY_WILDCARD 3          /* Every member or element */
+#define QUERY_SLICE    4          /* Elements from index to end by stride */
+#define QUERY_FILTER   5          /* Members or elements passing a test */
+
+#define QUERY_EXISTS   0          /* Comparisons made by a filter */
+#define QUERY_EQ       1
+#define QUERY_NE       2
+#define QUERY_LT       3
+#define QUERY_LE       4
+#define QUERY_GT       5
+#define QUERY_GE       6
+
+#define QUERY_START    1          /* Slice bounds that were given */
+#define QUERY_END      2
+
+struct jstep {
+
+  int      type;
+  int      descent;               /* Also applied to everything below */
+  char     *key;                  /* Key text, compared with the text of */
+  jsize_t  len;                   /* keys as it appears in the JSON */
+  uint32_t hash;                  /* amjson_key_hash() of key */
+  long     index;                 /* Negative counts back from the end, a
+				   * pointer token that is not an array
+				   * index holds -1. The start of a slice */
+  long     end;                   /* End of a slice, not included */
+  long     stride;                /* Step of a slice, always positive */
+  int      flags;                 /* QUERY_START and QUERY_END */
+  int      op;                    /* Comparison made by a filter */
+  int      literal;               /* Type of the value it compares with, 
+				   * a string is held in key and len */
+  double   number;
+  int      sub;                   /* Path of a filter, nsub steps of the */
+  int      nsub;                  /* query's sub steps starting at sub */
+};
+
+struct jquery {
+
+  int          nstep;
+  struct jstep *step;
+  int          nsub;              /* Steps of the paths of filters */
+  struct jstep *sub;
+  int          filter;            /* Parsing the path of a filter */
+};
+
+/* A path index has an entry for each jobject within its depth, found
+ * by the hash of its JSON Pointer whose text is kept alongside.
+ */
+#define PATH_UNUSED 0xffffffffU   /* Text offset of an unused entry */
+
+struct jpathentry {
+
+  uint32_t hash;                  /* amjson_key_hash() of the path */
+  joff_t   node;
+  uint32_t text;                  /* Offset and length of the path in */
+  uint32_t len;                   /* the index's text */
+};
+
+struct jpathindex {
+
+  size_t            size;         /* Bytes allocated */
+  joff_t            mask;         /* Entries less one */
+  int               complete;     /* No depth limit was reached */
+  struct jpathentry *entry;
+  char              *text;
+  size_t            textused;
+};
+
+struct jfirst {
+
+  struct jobject *jobject;
+};
+
+/* A query set merges the steps of its paths into a trie, each node is
+ * reached by one step and paths that share a prefix share its nodes.
+ */
+#define QUERYSET_SCAN 256         /* Most key steps below a node matched
+				   * by a single scan of an object */
+
+struct jtrie {
+
+  struct jstep *step;             /* Step to this node, none for the root */
+  int          child;             /* First child or -1 */
+  int          sibling;           /* Next child of the parent or -1 */
+  int          nkey;              /* Children whose step can name a key */
+  int          path;              /* First path ending here or -1 */
+  int          bit;               /* Position among the parent's key steps */
+  int          *table;            /* Key children by hash, -1 is empty */
+  uint32_t     mask;              /* Size of table less one */
+};
+
+struct jqueryset {
+
+  int           npath;
+  struct jquery **query;          /* Compiled paths, own the step keys */
+  int           *pathnext;        /* Next path ending at the same node */
+  int           nnode;
+  struct jtrie  *node;            /* node[0] is the root */
+  int           *table;           /* Storage for every node's table */
+};
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 
 static char *query_index(char *ptr);
 static char *query_identifier(char *ptr);
+static int query_add(struct jquery *query, struct jstep *step);
+static int query_number(char **optr, long *index);
+static int query_signed(char **optr, long *index);
+static int query_quoted(char **optr, struct jstep *step);
+static int query_filter(char **optr, struct jquery *query, 
+			struct jstep *step);
+static int query_segment(char **optr, struct jquery *query, int descent);
+static int query_pointer(char *ptr, struct jquery *query, char *text);
+static int query_dotted(char *ptr, struct jquery *query, char *text);
+static struct jobject *query_single(struct jhandle *jhandle, 
+				    struct jstep *step, 
+				    struct jobject *jobject);
+static struct jobject *query_child(struct jhandle *jhandle, 
+				   struct jobject *jobject, int type);
+static struct jobject *query_sibling(struct jhandle *jhandle, 
+				     struct jobject *jobject, int type);
+static double query_double(struct jhandle *jhandle, struct jobject *jobject);
+static int query_test(struct jhandle *jhandle, struct jquery *query,
+		      struct jstep *step, struct jobject *jobject);
+static int query_match(struct jhandle *jhandle, struct jquery *query,
+		       int i, struct jobject *jobject, amjson_stream_fn fn,
+		       void *arg, size_t *count);
+static int query_first(struct jhandle *jhandle, struct jobject *jobject,
+		       void *arg);
+static int queryset_equal(struct jstep *a, struct jstep *b);
+static size_t path_keylen(char *key, jsize_t len);
+static size_t path_indexlen(joff_t index);
+static size_t path_count(struct jhandle *jhandle, struct jobject *jobject,
+			 int depth, int maxdepth, size_t len, 
+			 size_t *text, int *complete);
+static void path_insert(struct jhandle *jhandle, struct jpathindex *index,
+			joff_t node, size_t text, size_t len, 
+			int depth, int maxdepth);
+static int queryset_tables(struct jqueryset *set);
+static int queryset_scan(struct jhandle *jhandle, struct jqueryset *set,
+			 struct jtrie *node, struct jobject *object, 
+			 struct jobject **result);
+static int queryset_walk(struct jhandle *jhandle, struct jqueryset *set,
+			 struct jtrie *node, struct jobject *jobject, 
+			 struct jobject **result);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -43,6 +196,13 @@ static char *query_index(char *ptr) {
   if (*ptr == '[') {
     ptr++;
 
+    if (*ptr == '-') {
+
+      /* Counts back from the end, [-1] is the last element */
+      ptr++;
+      if ((*ptr < '1') || (*ptr > '9')) goto fail;
+    }
+
     if (*ptr == '\0') goto fail;
     if (*ptr == '0') {
       ptr++;
@@ -111,10 +271,15 @@ struct jobject *amjson_query(struct jhandle *jhandle,
 
     } else {
       int index = 0;
+      int negative = 0;
       
       if (JOBJECT_TYPE(jobject) != AMJSON_ARRAY) goto fail;       	
 
       ptr++; /* '[' */     
+      if (*ptr == '-') {
+	negative = 1;
+	ptr++;
+      }
       while (ptr != (nptr-1)) {
 	index *= 10;
 	index += *ptr - '0';
@@ -123,6 +288,11 @@ struct jobject *amjson_query(struct jhandle *jhandle,
       
       ptr++; /* ']' */     
 
+      if (negative) {
+	if ((joff_t)index > ARRAY_COUNT(jobject)) goto fail;
+	index = ARRAY_COUNT(jobject) - index;
+      }
+
       jobject = amjson_array_index(jhandle, jobject, index);
       if (!jobject) goto fail;    
 
@@ -144,3 +314,1351 @@ struct jobject *amjson_query(struct jhandle *jhandle,
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_add(struct jquery *query, struct jstep *step) {
+
+  /* Steps are only counted until there is somewhere to put them, the
+   * steps of a filter's path are kept apart from those of the query.
+   */
+  struct jstep *base = (query->filter)?query->sub:query->step;
+  int *count = (query->filter)?&query->nsub:&query->nstep;
+
+  if (base) {
+    base[*count] = *step;
+    base[*count].hash = amjson_key_hash(step->key, step->len);
+  }
+
+  (*count)++;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_number(char **optr, long *index) {
+
+  /* Digits without a leading zero, 0 on its own is fine */
+  char *ptr = *optr;
+  long value = 0;
+
+  if (*ptr == '0') {
+    *optr  = ptr + 1;
+    *index = 0;
+    return 0;
+  }
+
+  if ((*ptr < '1') || (*ptr > '9')) return -1;
+
+  while ((*ptr >= '0') && (*ptr <= '9')) {
+    if (value > (LONG_MAX - 9) / 10) return -1;
+    value = (value * 10) + (*ptr++ - '0');
+  }
+
+  *optr  = ptr;
+  *index = value;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_signed(char **optr, long *index) {
+
+  /* Return 1 if a number was read, 0 if there was none and -1 if it was
+   * malformed. -0 is refused as amjson_query() does.
+   */
+  char *ptr = *optr;
+  int negative = 0;
+
+  if (*ptr == '-') {
+    negative = 1;
+    ptr++;
+    if (*ptr == '0') return -1;
+  } else if ((*ptr < '0') || (*ptr > '9')) {
+    return 0;
+  }
+
+  if (query_number(&ptr, index) != 0) return -1;
+  if (negative) *index = -*index;
+
+  *optr = ptr;
+  return 1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_quoted(char **optr, struct jstep *step) {
+
+  /* ["key"] with the key written as it appears in the JSON, so \"
+   * stands for a quote and does not end it.
+   */
+  char *ptr = *optr + 2;
+  char *key = ptr;
+
+  for (; (*ptr != '\0') && (*ptr != '"'); ptr++) {
+    if ((*ptr == '\\') && (ptr[1] != '\0')) ptr++;
+  }
+  if ((ptr[0] != '"') || (ptr[1] != ']')) return -1;
+  if ((size_t)(ptr - key) > AMJSON_MAXSTR) return -1;
+
+  step->type = QUERY_KEY;
+  step->key  = key;
+  step->len  = (jsize_t)(ptr - key);
+
+  *optr = ptr + 2;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_filter(char **optr, struct jquery *query,
+			struct jstep *step) {
+
+  /* [?(@path)] keeps what path leads to, [?(@path op literal)] what it
+   * leads to a value that compares with the literal. path is made of
+   * .key, ["key"] and [n] steps, op one of == != < <= > >= and literal
+   * a number, a "string" or true, false and null.
+   */
+  char *ptr = *optr + 2;
+  long index;
+
+  if ((ptr[0] != '(') || (ptr[1] != '@')) return -1;
+  ptr += 2;
+
+  step->type = QUERY_FILTER;
+  step->sub  = query->nsub;
+
+  query->filter = 1;
+  for (;;) {
+
+    struct jstep sub;
+
+    memset(&sub, 0, sizeof(struct jstep));
+    sub.key = "";
+
+    if (*ptr == '.') {
+
+      char *key = ++ptr;
+
+      while ((*ptr != '\0') && (strchr(".[]()=!<> ", *ptr) == (char *)0)) {
+	ptr++;
+      }
+      if ((ptr == key) || ((size_t)(ptr - key) > AMJSON_MAXSTR)) return -1;
+
+      sub.type = QUERY_KEY;
+      sub.key  = key;
+      sub.len  = (jsize_t)(ptr - key);
+
+    } else if ((ptr[0] == '[') && (ptr[1] == '"')) {
+
+      if (query_quoted(&ptr, &sub) != 0) return -1;
+
+    } else if (*ptr == '[') {
+
+      ptr++;
+      if (query_signed(&ptr, &index) != 1) return -1;
+      if (*ptr++ != ']') return -1;
+
+      sub.type  = QUERY_INDEX;
+      sub.index = index;
+
+    } else {
+      break;
+    }
+
+    if (query_add(query, &sub) != 0) return -1;
+  }
+  query->filter = 0;
+
+  step->nsub = query->nsub - step->sub;
+
+  while (*ptr == ' ') ptr++;
+
+  if (*ptr == ')') {
+    step->op = QUERY_EXISTS;
+  } else {
+
+    if (strncmp(ptr, "==", 2) == 0) {
+      step->op = QUERY_EQ;
+    } else if (strncmp(ptr, "!=", 2) == 0) {
+      step->op = QUERY_NE;
+    } else if (strncmp(ptr, "<=", 2) == 0) {
+      step->op = QUERY_LE;
+    } else if (strncmp(ptr, ">=", 2) == 0) {
+      step->op = QUERY_GE;
+    } else if (*ptr == '<') {
+      step->op = QUERY_LT;
+    } else if (*ptr == '>') {
+      step->op = QUERY_GT;
+    } else {
+      return -1;
+    }
+    ptr += ((step->op == QUERY_LT) || (step->op == QUERY_GT))?1:2;
+
+    while (*ptr == ' ') ptr++;
+
+    if (*ptr == '"') {
+
+      char *key = ++ptr;
+
+      for (; (*ptr != '\0') && (*ptr != '"'); ptr++) {
+	if ((*ptr == '\\') && (ptr[1] != '\0')) ptr++;
+      }
+      if (*ptr != '"') return -1;
+      if ((size_t)(ptr - key) > AMJSON_MAXSTR) return -1;
+
+      step->literal = AMJSON_STRING;
+      step->key     = key;
+      step->len     = (jsize_t)(ptr - key);
+      ptr++;
+
+    } else if (strncmp(ptr, "true", 4) == 0) {
+      step->literal = AMJSON_TRUE;
+      ptr += 4;
+    } else if (strncmp(ptr, "false", 5) == 0) {
+      step->literal = AMJSON_FALSE;
+      ptr += 5;
+    } else if (strncmp(ptr, "null", 4) == 0) {
+      step->literal = AMJSON_NULL;
+      ptr += 4;
+    } else if ((*ptr == '-') || ((*ptr >= '0') && (*ptr <= '9'))) {
+
+      char *end;
+
+      step->literal = AMJSON_NUMBER;
+      step->number  = strtod(ptr, &end);
+      if (end == ptr) return -1;
+      ptr = end;
+
+    } else {
+      return -1;
+    }
+
+    /* Only numbers and strings are ordered */
+    if ((step->op != QUERY_EQ) && (step->op != QUERY_NE) &&
+	(step->literal != AMJSON_NUMBER) &&
+	(step->literal != AMJSON_STRING)) {
+      return -1;
+    }
+
+    while (*ptr == ' ') ptr++;
+  }
+
+  if ((ptr[0] != ')') || (ptr[1] != ']')) return -1;
+
+  *optr = ptr + 2;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_segment(char **optr, struct jquery *query, int descent) {
+
+  char *ptr = *optr;
+  struct jstep step;
+  long index;
+  int found;
+
+  memset(&step, 0, sizeof(struct jstep));
+  step.descent = descent;
+  step.key     = "";
+
+  if ((ptr[0] == '[') && (ptr[1] == '"')) {
+
+    if (query_quoted(&ptr, &step) != 0) return -1;
+
+  } else if ((ptr[0] == '[') && (ptr[1] == '?')) {
+
+    if (query_filter(&ptr, query, &step) != 0) return -1;
+
+  } else if ((ptr[0] == '[') && (ptr[1] == '*') && (ptr[2] == ']')) {
+
+    step.type = QUERY_WILDCARD;
+    ptr += 3;
+
+  } else if (*ptr == '[') {
+
+    /* [n] or a slice [start:end:step] where each part is optional */
+    ptr++;
+    if ((found = query_signed(&ptr, &index)) < 0) return -1;
+
+    if (*ptr == ':') {
+
+      step.type   = QUERY_SLICE;
+      step.stride = 1;
+      if (found) {
+	step.flags |= QUERY_START;
+	step.index  = index;
+      }
+
+      ptr++;
+      if ((found = query_signed(&ptr, &step.end)) < 0) return -1;
+      if (found) step.flags |= QUERY_END;
+
+      if (*ptr == ':') {
+	ptr++;
+	if ((found = query_signed(&ptr, &index)) < 0) return -1;
+	if (found) {
+	  if (index <= 0) return -1;
+	  step.stride = index;
+	}
+      }
+
+    } else {
+
+      if (!found) return -1;
+
+      step.type  = QUERY_INDEX;
+      step.index = index;
+    }
+
+    if (*ptr++ != ']') return -1;
+
+  } else {
+
+    char *key = ptr;
+
+    ptr = query_identifier(ptr);
+    if ((ptr == key) || ((size_t)(ptr - key) > AMJSON_MAXSTR)) return -1;
+
+    step.type = ((ptr - key == 1) && (*key == '*'))?
+      QUERY_WILDCARD:QUERY_KEY;
+    step.key  = key;
+    step.len  = (jsize_t)(ptr - key);
+  }
+
+  if (query_add(query, &step) != 0) return -1;
+
+  *optr = ptr;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_pointer(char *ptr, struct jquery *query, char *text) {
+
+  /* RFC 6901, each reference token follows a '/' with "~1" standing for
+   * '/' and "~0" for '~'. The unescaped tokens are written to text.
+   */
+  while (*ptr == '/') {
+
+    struct jstep step;
+    char *key = text;
+    size_t len = 0;
+    long index = -1;
+    char *iptr;
+
+    for (ptr++; (*ptr != '\0') && (*ptr != '/'); len++) {
+
+      char c = *ptr++;
+
+      if (c == '~') {
+	if (*ptr == '0') {
+	  c = '~';
+	} else if (*ptr == '1') {
+	  c = '/';
+	} else {
+	  return -1;
+	}
+	ptr++;
+      }
+      if (query->step) *text++ = c;
+    }
+
+    if (len > AMJSON_MAXSTR) return -1;
+
+    /* A token is an array index if it is only digits, "-" names the
+     * element after the last and so never matches.
+     */
+    if (query->step) {
+      iptr = key;
+      if ((query_number(&iptr, &index) != 0) ||
+	  (iptr != &key[len])) {
+	index = -1;
+      }
+    }
+
+    memset(&step, 0, sizeof(struct jstep));
+    step.type  = QUERY_POINTER;
+    step.key   = key;
+    step.len   = (jsize_t)len;
+    step.index = index;
+
+    if (query_add(query, &step) != 0) return -1;
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_dotted(char *ptr, struct jquery *query, char *text) {
+
+  /* The syntax of amjson_query() along with ["key"] for keys holding
+   * '.', '[' or ']', * and [*] for every member or element, slices
+   * [start:end:step], filters [?(...)] and ..step to apply a step at
+   * any depth.
+   */
+  int descent = 0;
+
+  (void)text;
+
+  if (*ptr == '\0') return -1;
+
+  if ((ptr[0] == '.') && (ptr[1] == '.')) {
+    descent = 1;
+    ptr += 2;
+  }
+
+  for (;;) {
+
+    if (query_segment(&ptr, query, descent) != 0) return -1;
+    descent = 0;
+
+    if (*ptr == '\0') break;
+    if ((ptr[0] == '.') && (ptr[1] == '.')) {
+      descent = 1;
+      ptr += 2;
+    } else if (*ptr == '.') {
+      ptr++;
+    } else if (*ptr != '[') {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jquery *amjson_query_compile(char *path) {
+
+  /* Parsed twice, once to count the steps and then to fill them in. The
+   * steps and the text of their keys share a single allocation.
+   */
+  struct jquery count;
+  struct jquery *query;
+  size_t len = strlen(path);
+  int pointer = ((*path == '/') || (*path == '\0'));
+  char *text;
+
+  memset(&count, 0, sizeof(struct jquery));
+  if (((pointer)?query_pointer(path, &count, (char *)0):
+       query_dotted(path, &count, (char *)0)) != 0) {
+    errno = EINVAL;
+    return (struct jquery *)0;
+  }
+
+  query = (struct jquery *)malloc(sizeof(struct jquery) +
+				  (count.nstep + count.nsub) *
+				  sizeof(struct jstep) + len + 1);
+  if (!query) {
+    errno = ENOMEM;
+    return (struct jquery *)0;
+  }
+
+  memset(query, 0, sizeof(struct jquery));
+  query->step = (struct jstep *)&query[1];
+  query->sub  = &query->step[count.nstep];
+  text        = (char *)&query->sub[count.nsub];
+
+  /* Keys of the dotted syntax are kept as they are in the path */
+  if (!pointer) {
+    memcpy(text, path, len + 1);
+    path = text;
+  }
+
+  if (((pointer)?query_pointer(path, query, text):
+       query_dotted(path, query, text)) != 0) {
+    free(query);
+    errno = EINVAL;
+    return (struct jquery *)0;
+  }
+
+  return query;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jobject *query_single(struct jhandle *jhandle,
+				    struct jstep *step,
+				    struct jobject *jobject) {
+
+  /* Apply a step that leads to at most one jobject */
+  int type = JOBJECT_TYPE(jobject);
+  long index = step->index;
+
+  if ((type == AMJSON_OBJECT) && (step->type != QUERY_INDEX)) {
+
+    return amjson_object_find_hash(jhandle, jobject, step->key,
+				   step->len, step->hash);
+
+  } else if ((type == AMJSON_ARRAY) && (step->type != QUERY_KEY)) {
+
+    if (index < 0) {
+      if (step->type == QUERY_POINTER) return (struct jobject *)0;
+      index += (long)ARRAY_COUNT(jobject);
+      if (index < 0) return (struct jobject *)0;
+    }
+    if (index >= (long)ARRAY_COUNT(jobject)) return (struct jobject *)0;
+
+    return amjson_array_index(jhandle, jobject, (joff_t)index);
+  }
+
+  return (struct jobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jobject *query_child(struct jhandle *jhandle,
+				   struct jobject *jobject, int type) {
+
+  /* The first element of an array or value of an object */
+  if ((type != AMJSON_OBJECT) && (type != AMJSON_ARRAY)) {
+    return (struct jobject *)0;
+  }
+  if (ARRAY_COUNT(jobject) == 0) return (struct jobject *)0;
+
+  jobject = JOBJECT_AT(jhandle, jobject->u.object.child);
+  if (type == AMJSON_OBJECT) jobject = JOBJECT_AT(jhandle, jobject->next);
+
+  return jobject;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jobject *query_sibling(struct jhandle *jhandle,
+				     struct jobject *jobject, int type) {
+
+  /* The next element or value, type is that of the parent */
+  if (jobject->next == AMJSON_INVALID) return (struct jobject *)0;
+
+  jobject = JOBJECT_AT(jhandle, jobject->next);
+  if (type == AMJSON_OBJECT) jobject = JOBJECT_AT(jhandle, jobject->next);
+
+  return jobject;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static double query_double(struct jhandle *jhandle, struct jobject *jobject) {
+
+  /* Number text is not terminated, longer than any sensible double is
+   * truncated.
+   */
+  char number[64];
+  jsize_t len = JOBJECT_STRING_LEN(jobject);
+
+  if (len >= sizeof(number)) len = sizeof(number) - 1;
+  memcpy(number, JOBJECT_STRING_PTR(jhandle, jobject), len);
+  number[len] = '\0';
+
+  return strtod(number, (char **)0);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_test(struct jhandle *jhandle, struct jquery *query,
+		      struct jstep *step, struct jobject *jobject) {
+
+  /* A value of another type is only ever != the literal */
+  int i, type;
+  int cmp = 0;
+
+  for (i=0; (jobject) && (i<step->nsub); i++) {
+    jobject = query_single(jhandle, &query->sub[step->sub + i], jobject);
+  }
+
+  if (!jobject) return 0;
+  if (step->op == QUERY_EXISTS) return 1;
+
+  type = JOBJECT_TYPE(jobject);
+  if (type != step->literal) return (step->op == QUERY_NE);
+
+  if (type == AMJSON_STRING) {
+
+    jsize_t len = JOBJECT_STRING_LEN(jobject);
+
+    cmp = memcmp(JOBJECT_STRING_PTR(jhandle, jobject), step->key,
+		 (len < step->len)?len:step->len);
+    if (cmp == 0) cmp = (len > step->len) - (len < step->len);
+
+  } else if (type == AMJSON_NUMBER) {
+
+    double number = query_double(jhandle, jobject);
+
+    cmp = (number > step->number) - (number < step->number);
+  }
+
+  switch (step->op) {
+  case QUERY_EQ: return (cmp == 0);
+  case QUERY_NE: return (cmp != 0);
+  case QUERY_LT: return (cmp < 0);
+  case QUERY_LE: return (cmp <= 0);
+  case QUERY_GT: return (cmp > 0);
+  default:       return (cmp >= 0);
+  }
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_match(struct jhandle *jhandle, struct jquery *query,
+		       int i, struct jobject *jobject, amjson_stream_fn fn,
+		       void *arg, size_t *count) {
+
+  /* Apply step i to jobject and the rest of the query to each result,
+   * matches go to fn. Return !0 once fn asks to stop.
+   */
+  struct jstep *step;
+  struct jobject *child;
+  int type;
+
+  if (i == query->nstep) {
+    (*count)++;
+    return fn(jhandle, jobject, arg);
+  }
+
+  step = &query->step[i];
+  type = JOBJECT_TYPE(jobject);
+
+  switch (step->type) {
+
+  case QUERY_WILDCARD:
+  case QUERY_FILTER:
+    for (child = query_child(jhandle, jobject, type); child;
+	 child = query_sibling(jhandle, child, type)) {
+
+      if ((step->type == QUERY_FILTER) &&
+	  (!query_test(jhandle, query, step, child))) continue;
+
+      if (query_match(jhandle, query, i + 1, child, fn, arg, count)) {
+	return 1;
+      }
+    }
+    break;
+
+  case QUERY_SLICE:
+    if (type == AMJSON_ARRAY) {
+
+      long n = (long)ARRAY_COUNT(jobject);
+      long start = (step->flags & QUERY_START)?step->index:0;
+      long end = (step->flags & QUERY_END)?step->end:n;
+      long k, s;
+
+      if (start < 0) start = ((start += n) < 0)?0:start;
+      if (start > n) start = n;
+      if (end < 0) end = ((end += n) < 0)?0:end;
+      if (end > n) end = n;
+
+      if (start < end) {
+
+	child = amjson_array_index(jhandle, jobject, (joff_t)start);
+
+	for (k=start; k<end; k+=step->stride) {
+
+	  if (query_match(jhandle, query, i + 1, child, fn, arg, count)) {
+	    return 1;
+	  }
+	  for (s=0; (s<step->stride) && (k+s+1<end); s++) {
+	    child = JOBJECT_AT(jhandle, child->next);
+	  }
+	}
+      }
+    }
+    break;
+
+  default:
+    if ((child = query_single(jhandle, step, jobject)) !=
+	(struct jobject *)0) {
+      if (query_match(jhandle, query, i + 1, child, fn, arg, count)) {
+	return 1;
+      }
+    }
+    break;
+  }
+
+  /* ".." applies the step again below, a scalar never matches a step so
+   * only objects and arrays are visited.
+   */
+  if (step->descent) {
+
+    for (child = query_child(jhandle, jobject, type); child;
+	 child = query_sibling(jhandle, child, type)) {
+
+      int ctype = JOBJECT_TYPE(child);
+
+      if ((ctype != AMJSON_OBJECT) && (ctype != AMJSON_ARRAY)) continue;
+
+      if (query_match(jhandle, query, i, child, fn, arg, count)) return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int query_first(struct jhandle *jhandle, struct jobject *jobject,
+		       void *arg) {
+
+  (void)jhandle;
+  ((struct jfirst *)arg)->jobject = jobject;
+  return 1;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_query_exec(struct jhandle *jhandle,
+				  struct jobject *jobject,
+				  struct jquery *query) {
+  int i;
+
+  for (i=0; (jobject) && (i<query->nstep); i++) {
+
+    struct jstep *step = &query->step[i];
+
+    /* The rest may match many, the first of them is returned */
+    if ((step->descent) || (step->type >= QUERY_WILDCARD)) {
+
+      struct jfirst first;
+      size_t count = 0;
+
+      first.jobject = (struct jobject *)0;
+      (void)query_match(jhandle, query, i, jobject, query_first, &first,
+			&count);
+
+      return first.jobject;
+    }
+
+    jobject = query_single(jhandle, step, jobject);
+  }
+
+  return jobject;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+size_t amjson_query_foreach(struct jhandle *jhandle,
+			    struct jobject *jobject, struct jquery *query,
+			    amjson_stream_fn fn, void *arg) {
+
+  size_t count = 0;
+
+  (void)query_match(jhandle, query, 0, jobject, fn, arg, &count);
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_query_free(struct jquery *query) {
+
+  free(query);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int queryset_equal(struct jstep *a, struct jstep *b) {
+
+  return ((a->type == b->type) && (a->index == b->index) &&
+	  (a->len == b->len) && (memcmp(a->key, b->key, a->len) == 0));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int queryset_tables(struct jqueryset *set) {
+
+  /* Nodes whose keys are matched by a scan get a table of their key 
+   * children, sized to a power of two at least twice their number.
+   */
+  size_t total = 0;
+  int *table;
+  int i;
+
+  for (i=0; i<set->nnode; i++) {
+
+    struct jtrie *node = &set->node[i];
+    uint32_t size = 1;
+
+    if ((node->nkey < 2) || (node->nkey > QUERYSET_SCAN)) continue;
+
+    while (size < (uint32_t)node->nkey * 2) size <<= 1;
+    node->mask = size - 1;
+    total += size;
+  }
+
+  set->table = (int *)0;
+  if (total == 0) return 0;
+
+  if ((set->table = (int *)malloc(total * sizeof(int))) == (int *)0) {
+    return -1;
+  }
+
+  for (i=0, table=set->table; i<set->nnode; i++) {
+
+    struct jtrie *node = &set->node[i];
+    int child, bit = 0;
+
+    if ((node->nkey < 2) || (node->nkey > QUERYSET_SCAN)) continue;
+
+    node->table = table;
+    table += node->mask + 1;
+    memset(node->table, 0xff, (node->mask + 1) * sizeof(int));
+
+    for (child = node->child; child != -1; 
+	 child = set->node[child].sibling) {
+
+      struct jstep *step = set->node[child].step;
+      uint32_t slot;
+
+      if (step->type == QUERY_INDEX) continue;
+
+      set->node[child].bit = bit++;
+
+      slot = step->hash & node->mask;
+      while (node->table[slot] != -1) slot = (slot + 1) & node->mask;
+      node->table[slot] = child;
+    }
+  }
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jqueryset *amjson_queryset_compile(char **paths, int npath) {
+
+  struct jqueryset *set;
+  struct jquery **query;
+  int nstep = 0;
+  int i, j;
+
+  if (npath <= 0) {
+    errno = EINVAL;
+    return (struct jqueryset *)0;
+  }
+
+  query = (struct jquery **)calloc(npath, sizeof(struct jquery *));
+  if (!query) {
+    errno = ENOMEM;
+    return (struct jqueryset *)0;
+  }
+
+  for (i=0; i<npath; i++) {
+    if ((query[i] = amjson_query_compile(paths[i])) == (struct jquery *)0) {
+      goto fail;
+    }
+    nstep += query[i]->nstep;
+
+    /* Each path names at most one jobject */
+    for (j=0; j<query[i]->nstep; j++) {
+      if ((query[i]->step[j].descent) || 
+	  (query[i]->step[j].type >= QUERY_WILDCARD)) {
+	errno = EINVAL;
+	goto fail;
+      }
+    }
+  }
+
+  /* The trie has at most a node per step plus the root */
+  set = (struct jqueryset *)malloc(sizeof(struct jqueryset) + 
+				   npath * sizeof(int) +
+				   (nstep + 1) * sizeof(struct jtrie));
+  if (!set) {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  set->npath    = npath;
+  set->query    = query;
+  set->node     = (struct jtrie *)&set[1];
+  set->pathnext = (int *)&set->node[nstep + 1];
+  set->nnode    = 1;
+
+  memset(&set->node[0], 0, sizeof(struct jtrie));
+  set->node[0].child = -1;
+  set->node[0].path  = -1;
+  set->node[0].table = (int *)0;
+
+  for (i=0; i<npath; i++) {
+
+    struct jtrie *node = &set->node[0];
+
+    for (j=0; j<query[i]->nstep; j++) {
+
+      struct jstep *step = &query[i]->step[j];
+      struct jtrie *child;
+      int *link = &node->child;
+
+      while ((*link != -1) && 
+	     (!queryset_equal(set->node[*link].step, step))) {
+	link = &set->node[*link].sibling;
+      }
+
+      if (*link != -1) {
+
+	child = &set->node[*link];
+
+      } else {
+
+	*link = set->nnode;
+	child = &set->node[set->nnode++];
+
+	child->step    = step;
+	child->child   = -1;
+	child->sibling = -1;
+	child->nkey    = 0;
+	child->path    = -1;
+	child->table   = (int *)0;
+
+	if (step->type != QUERY_INDEX) node->nkey++;
+      }
+
+      node = child;
+    }
+
+    /* Identical paths end at the same node, results keep path order */
+    {
+      int *link = &node->path;
+
+      while (*link != -1) link = &set->pathnext[*link];
+      *link = i;
+      set->pathnext[i] = -1;
+    }
+  }
+
+  if (queryset_tables(set) != 0) {
+    free(set);
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  return set;
+
+ fail:
+  for (i=0; i<npath; i++) amjson_query_free(query[i]);
+  free(query);
+  return (struct jqueryset *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int queryset_scan(struct jhandle *jhandle, struct jqueryset *set,
+			 struct jtrie *node, struct jobject *object, 
+			 struct jobject **result) {
+
+  /* One pass over the keys for every key step below node, each key is
+   * hashed once and looked up in the node's table. As with 
+   * amjson_object_find() the first of duplicate keys is the one used.
+   */
+  uint32_t seen[QUERYSET_SCAN / 32];
+  int remain = node->nkey;
+  int found = 0;
+  joff_t next;
+
+  if (OBJECT_COUNT(object) == 0) return 0;
+
+  memset(seen, 0, sizeof(seen));
+
+  next = object->u.object.child;
+  do {
+
+    struct jobject *key = JOBJECT_AT(jhandle, next);
+    struct jobject *value = JOBJECT_AT(jhandle, key->next);
+    jsize_t len = JOBJECT_STRING_LEN(key);
+    char *ptr = JOBJECT_STRING_PTR(jhandle, key);
+    uint32_t hash = amjson_key_hash(ptr, len);
+    uint32_t slot = hash & node->mask;
+    int child;
+
+    /* A key and a pointer step can share a key, so probe to the end */
+    while ((child = node->table[slot]) != -1) {
+
+      struct jtrie *match = &set->node[child];
+      struct jstep *step = match->step;
+      int bit = match->bit;
+
+      if ((step->hash == hash) && (step->len == len) &&
+	  ((seen[bit / 32] & (1U << (bit % 32))) == 0) &&
+	  (memcmp(step->key, ptr, len) == 0)) {
+
+	seen[bit / 32] |= (1U << (bit % 32));
+	remain--;
+
+	found += queryset_walk(jhandle, set, match, value, result);
+      }
+
+      slot = (slot + 1) & node->mask;
+    }
+
+    next = value->next;
+
+  } while ((next != AMJSON_INVALID) && (remain));
+
+  return found;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int queryset_walk(struct jhandle *jhandle, struct jqueryset *set,
+			 struct jtrie *node, struct jobject *jobject, 
+			 struct jobject **result) {
+
+  int type = JOBJECT_TYPE(jobject);
+  int found = 0;
+  int child, path;
+
+  for (path = node->path; path != -1; path = set->pathnext[path]) {
+    result[path] = jobject;
+    found++;
+  }
+
+  if ((type == AMJSON_OBJECT) && (node->nkey > 0)) {
+
+    /* A lone key, or more than a scan can track, is looked up directly
+     * and so can use the object's key hash.
+     */
+    if ((node->nkey > 1) && (node->nkey <= QUERYSET_SCAN)) {
+      return found + queryset_scan(jhandle, set, node, jobject, result);
+    }
+
+    for (child = node->child; child != -1; 
+	 child = set->node[child].sibling) {
+
+      struct jstep *step = set->node[child].step;
+      struct jobject *value;
+
+      if (step->type == QUERY_INDEX) continue;
+
+      value = amjson_object_find_hash(jhandle, jobject, step->key, 
+				      step->len, step->hash);
+      if (value) {
+	found += queryset_walk(jhandle, set, &set->node[child], value, 
+			       result);
+      }
+    }
+
+  } else if (type == AMJSON_ARRAY) {
+
+    for (child = node->child; child != -1; 
+	 child = set->node[child].sibling) {
+
+      struct jstep *step = set->node[child].step;
+      long index = step->index;
+
+      if (step->type == QUERY_KEY) continue;
+
+      if (index < 0) {
+	if (step->type == QUERY_POINTER) continue;
+	index += (long)ARRAY_COUNT(jobject);
+	if (index < 0) continue;
+      }
+      if (index >= (long)ARRAY_COUNT(jobject)) continue;
+
+      found += queryset_walk(jhandle, set, &set->node[child],
+			     amjson_array_index(jhandle, jobject, 
+						(joff_t)index), result);
+    }
+  }
+
+  return found;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_queryset_exec(struct jhandle *jhandle, struct jobject *jobject,
+			 struct jqueryset *set, struct jobject **result) {
+  int i;
+
+  for (i=0; i<set->npath; i++) result[i] = (struct jobject *)0;
+
+  return queryset_walk(jhandle, set, &set->node[0], jobject, result);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_queryset_free(struct jqueryset *set) {
+
+  int i;
+
+  for (i=0; i<set->npath; i++) amjson_query_free(set->query[i]);
+  free(set->query);
+  free(set->table);
+  free(set);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t path_keylen(char *key, jsize_t len) {
+
+  /* Length of a key as a pointer token, '~' and '/' are escaped */
+  size_t count = len;
+  jsize_t i;
+
+  for (i=0; i<len; i++) {
+    if ((key[i] == '~') || (key[i] == '/')) count++;
+  }
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t path_indexlen(joff_t index) {
+
+  size_t count = 1;
+
+  while (index >= 10) {
+    index /= 10;
+    count++;
+  }
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static size_t path_count(struct jhandle *jhandle, struct jobject *jobject,
+			 int depth, int maxdepth, size_t len, 
+			 size_t *text, int *complete) {
+
+  /* Count the entries below jobject and the text of their paths, len
+   * being the length of the path of jobject.
+   */
+  int type = JOBJECT_TYPE(jobject);
+  struct jobject *child;
+  size_t count = 1;
+  joff_t position = 0;
+  joff_t next;
+
+  *text += len;
+
+  if ((child = query_child(jhandle, jobject, type)) == (struct jobject *)0) {
+    return count;
+  }
+
+  if ((maxdepth) && (depth == maxdepth)) {
+    *complete = 0;
+    return count;
+  }
+
+  next = jobject->u.object.child;
+  do {
+
+    struct jobject *key = JOBJECT_AT(jhandle, next);
+    size_t tlen;
+
+    if (type == AMJSON_OBJECT) {
+      tlen = path_keylen(JOBJECT_STRING_PTR(jhandle, key),
+			 JOBJECT_STRING_LEN(key));
+      next = key->next;
+    } else {
+      tlen = path_indexlen(position++);
+    }
+
+    count += path_count(jhandle, JOBJECT_AT(jhandle, next), depth + 1, 
+			maxdepth, len + 1 + tlen, text, complete);
+
+    next = JOBJECT_AT(jhandle, next)->next;
+
+  } while (next != AMJSON_INVALID);
+
+  return count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void path_insert(struct jhandle *jhandle, struct jpathindex *index,
+			joff_t node, size_t text, size_t len, 
+			int depth, int maxdepth) {
+
+  /* The path of node is already in the index's text at text. Each child
+   * starts with a copy of it followed by its own token.
+   */
+  struct jobject *jobject = JOBJECT_AT(jhandle, node);
+  int type = JOBJECT_TYPE(jobject);
+  uint32_t hash = amjson_key_hash(&index->text[text], 
+				  (len > AMJSON_MAXSTR)?
+				  AMJSON_MAXSTR:(jsize_t)len);
+  joff_t slot = hash & index->mask;
+  joff_t next, position = 0;
+
+  while (index->entry[slot].text != PATH_UNUSED) {
+    slot = (slot + 1) & index->mask;
+  }
+
+  index->entry[slot].hash = hash;
+  index->entry[slot].node = node;
+  index->entry[slot].text = (uint32_t)text;
+  index->entry[slot].len  = (uint32_t)len;
+
+  if (query_child(jhandle, jobject, type) == (struct jobject *)0) return;
+  if ((maxdepth) && (depth == maxdepth)) return;
+
+  next = jobject->u.object.child;
+  do {
+
+    struct jobject *key = JOBJECT_AT(jhandle, next);
+    char *ptr = &index->text[index->textused];
+    size_t start = index->textused;
+
+    memcpy(ptr, &index->text[text], len);
+    ptr += len;
+    *ptr++ = '/';
+
+    if (type == AMJSON_OBJECT) {
+
+      char *kptr = JOBJECT_STRING_PTR(jhandle, key);
+      jsize_t i, klen = JOBJECT_STRING_LEN(key);
+
+      for (i=0; i<klen; i++) {
+	if (kptr[i] == '~') {
+	  *ptr++ = '~';
+	  *ptr++ = '0';
+	} else if (kptr[i] == '/') {
+	  *ptr++ = '~';
+	  *ptr++ = '1';
+	} else {
+	  *ptr++ = kptr[i];
+	}
+      }
+      next = key->next;
+
+    } else {
+
+      size_t tlen = path_indexlen(position);
+      joff_t value = position++;
+
+      ptr += tlen;
+      do {
+	*--ptr = (char)('0' + (value % 10));
+	value /= 10;
+      } while (value);
+      ptr += tlen;
+    }
+
+    index->textused = ptr - index->text;
+    path_insert(jhandle, index, next, start, index->textused - start,
+		depth + 1, maxdepth);
+
+    next = JOBJECT_AT(jhandle, next)->next;
+
+  } while (next != AMJSON_INVALID);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_path_index_build(struct jhandle *jhandle, int maxdepth) {
+
+  struct jpathindex *index;
+  size_t count, size = 1;
+  size_t text = 0;
+  size_t i;
+  int complete = 1;
+
+  if ((jhandle->used == 0) || (maxdepth < 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  free(jhandle->pathindex);
+  jhandle->pathindex = (struct jpathindex *)0;
+
+  /* At most half full, entries are numbered by joff_t and their text
+   * is found by a 32 bit offset.
+   */
+  count = path_count(jhandle, JOBJECT_ROOT(jhandle), 0, maxdepth, 0, 
+		     &text, &complete);
+  while (size < count * 2) size <<= 1;
+
+  if ((size > (size_t)JOFF_MAX) || (text >= (size_t)PATH_UNUSED)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  index = (struct jpathindex *)malloc(sizeof(struct jpathindex) + 
+				      size * sizeof(struct jpathentry) +
+				      text);
+  if (!index) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  index->size     = sizeof(struct jpathindex) + 
+                    size * sizeof(struct jpathentry) + text;
+  index->mask     = (joff_t)(size - 1);
+  index->complete = complete;
+  index->entry    = (struct jpathentry *)&index[1];
+  index->text     = (char *)&index->entry[size];
+  index->textused = 0;
+
+  for (i=0; i<size; i++) index->entry[i].text = PATH_UNUSED;
+
+  path_insert(jhandle, index, jhandle->root, 0, 0, 0, maxdepth);
+
+  jhandle->pathindex = index;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_path_lookup(struct jhandle *jhandle, char *path) {
+
+  struct jpathindex *index = jhandle->pathindex;
+  struct jquery *query;
+  struct jobject *jobject;
+
+  if ((*path != '/') && (*path != '\0')) {
+    errno = EINVAL;
+    return (struct jobject *)0;
+  }
+
+  if (index) {
+
+    size_t len = strlen(path);
+    uint32_t hash;
+    joff_t slot;
+
+    /* Paths longer than a key are hashed only so far, the text decides */
+    hash = amjson_key_hash(path, (len > AMJSON_MAXSTR)?
+			   AMJSON_MAXSTR:(jsize_t)len);
+
+    for (slot = hash & index->mask; 
+	 index->entry[slot].text != PATH_UNUSED;
+	 slot = (slot + 1) & index->mask) {
+
+      struct jpathentry *entry = &index->entry[slot];
+
+      if ((entry->hash == hash) && (entry->len == len) &&
+	  (memcmp(&index->text[entry->text], path, len) == 0)) {
+	return JOBJECT_AT(jhandle, entry->node);
+      }
+    }
+
+    if (index->complete) return (struct jobject *)0;
+  }
+
+  /* Not indexed, or deeper than the index goes */
+  if ((query = amjson_query_compile(path)) == (struct jquery *)0) {
+    return (struct jobject *)0;
+  }
+  jobject = amjson_query_exec(jhandle, JOBJECT_ROOT(jhandle), query);
+  amjson_query_free(query);
+
+  return jobject;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+size_t amjson_path_index_size(struct jhandle *jhandle) {
+
+  return (jhandle->pathindex)?jhandle->pathindex->size:0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_path_index_free(struct jhandle *jhandle) {
+
+  free(jhandle->pathindex);
+  jhandle->pathindex = (struct jpathindex *)0;
+}
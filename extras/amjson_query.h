@@ -30,6 +30,11 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 /* -------------------------------------------------------------------- */
 
+struct jquery;
+struct jqueryset;
+
+/* -------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 extern "C" {  
 #endif
@@ -37,6 +42,17 @@ extern "C" {
 /* -------------------------------------------------------------------- */
 
 struct jobject *amjson_query(struct jhandle *jhandle, struct jobject *jobject, char *ptr);
+struct jquery *amjson_query_compile(char *path);
+struct jobject *amjson_query_exec(struct jhandle *jhandle, struct jobject *jobject, struct jquery *query);
+size_t amjson_query_foreach(struct jhandle *jhandle, struct jobject *jobject, struct jquery *query, amjson_stream_fn fn, void *arg);
+void amjson_query_free(struct jquery *query);
+struct jqueryset *amjson_queryset_compile(char **paths, int npath);
+int amjson_queryset_exec(struct jhandle *jhandle, struct jobject *jobject, struct jqueryset *set, struct jobject **result);
+void amjson_queryset_free(struct jqueryset *set);
+int amjson_path_index_build(struct jhandle *jhandle, int maxdepth);
+struct jobject *amjson_path_lookup(struct jhandle *jhandle, char *path);
+size_t amjson_path_index_size(struct jhandle *jhandle);
+void amjson_path_index_free(struct jhandle *jhandle);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -0,0 +1,134 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "amjson.h"
+#include "extras/amjson_stats.h"
+
+/* -------------------------------------------------------------------- */
+
+#define STATS_WIDTH   4           /* Ratio covered by each bucket */
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static void stats_add(struct amjson_stats *stats, unsigned int ratio);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static void stats_add(struct amjson_stats *stats, unsigned int ratio) {
+
+  unsigned int i = ratio / STATS_WIDTH;
+
+  if (i >= AMJSON_STATS_BUCKETS) i = AMJSON_STATS_BUCKETS - 1;
+
+  if (stats->total == AMJSON_STATS_WINDOW) {
+
+    /* Age what we have, rounding up so a lone decode is not forgotten */
+    stats->total = 0;
+    for (i = 0; i < AMJSON_STATS_BUCKETS; i++) {
+      stats->bucket[i] = (stats->bucket[i] + 1) / 2;
+      stats->total    += stats->bucket[i];
+    }
+
+    i = ratio / STATS_WIDTH;
+    if (i >= AMJSON_STATS_BUCKETS) i = AMJSON_STATS_BUCKETS - 1;
+  }
+
+  stats->bucket[i]++;
+  stats->total++;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_stats_init(struct amjson_stats *stats, unsigned int percentile) {
+
+  memset(stats, 0, sizeof(struct amjson_stats));
+
+  if (percentile == 0) percentile = 1;
+  if (percentile > 100) percentile = 100;
+
+  stats->percentile = percentile;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_stats_record(struct amjson_stats *stats, bsize_t len, 
+			 joff_t used) {
+
+  if (len == 0) return;
+
+  /* Round up so the estimate errs on the side of no realloc */
+  stats_add(stats, 
+	    (unsigned int)((((uint64_t)used * 1024) + len - 1) / len));
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+unsigned int amjson_stats_ratio(struct amjson_stats *stats) {
+
+  uint64_t want;
+  uint64_t seen = 0;
+  unsigned int i;
+
+  if (stats->total == 0) return 0;
+
+  want = (((uint64_t)stats->total * stats->percentile) + 99) / 100;
+
+  for (i = 0; i < AMJSON_STATS_BUCKETS - 1; i++) {
+    seen += stats->bucket[i];
+    if (seen >= want) break;
+  }
+
+  /* The top of the bucket covers every ratio that landed in it */
+  return (i + 1) * STATS_WIDTH;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+joff_t amjson_stats_guess(struct amjson_stats *stats, bsize_t len) {
+
+  uint64_t count;
+  unsigned int ratio = amjson_stats_ratio(stats);
+
+  if (ratio == 0) return JOBJECT_COUNT_GUESS(len);
+
+  count = (((uint64_t)len * ratio) / 1024) + 1;
+
+  return (count > JOFF_MAX)?JOFF_MAX:(joff_t)count;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+void amjson_stats_seed(struct amjson_stats *stats, unsigned int ratio) {
+
+  if (ratio == 0) return;
+
+  stats_add(stats, ratio - 1);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
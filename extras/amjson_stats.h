@@ -0,0 +1,100 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#ifndef _AMJSON_STATS_H_
+#define _AMJSON_STATS_H_
+
+#include "amjson.h"
+
+/* -------------------------------------------------------------------- */
+
+#define AMJSON_STATS_BUCKETS  256         /* Ratios are kept in jobjects per 
+					   * 1024 bytes of JSON, each bucket 
+					   * covers 4 of them */
+#define AMJSON_STATS_WINDOW   1024        /* Counts are halved once this many
+					   * decodes have been recorded so the
+					   * estimate follows recent traffic */
+
+struct amjson_stats {
+
+  uint32_t     bucket[AMJSON_STATS_BUCKETS];
+  uint32_t     total;             /* Decodes currently held in buckets */
+  unsigned int percentile;        /* Percentile used for estimates */
+};
+
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {  
+#endif
+
+/* -------------------------------------------------------------------- */
+
+/* Summary: Initialise statistics for one class of message, keep one of
+ *          these for each kind of document that is decoded repeatedly.
+ * stats:      This is a pointer to an uninitialised amjson_stats structure.
+ * percentile: Percentile of recorded decodes that an estimate must 
+ *             be large enough for, between 1 and 100.
+ */
+void amjson_stats_init(struct amjson_stats *stats, unsigned int percentile);
+
+/* Summary: Record the outcome of a decode.
+ * stats:   This is a pointer to an initialised amjson_stats structure.
+ * len:     This is the length of the JSON buffer that was decoded.
+ * used:    This is the count of jobjects the decode used.
+ */
+void amjson_stats_record(struct amjson_stats *stats, bsize_t len, 
+			 joff_t used);
+
+/* Summary: Estimate the jobject count needed to decode a JSON buffer,
+ *          suitable for passing to amjson_alloc().
+ * stats:   This is a pointer to an initialised amjson_stats structure.
+ * len:     This is the length of the JSON buffer to be decoded.
+ *
+ * Return JOBJECT_COUNT_GUESS(len) until something has been recorded.
+ */
+joff_t amjson_stats_guess(struct amjson_stats *stats, bsize_t len);
+
+/* Summary: Return the learned ratio in jobjects per 1024 bytes of JSON,
+ *          0 if nothing has been recorded. This may be saved and later
+ *          restored with amjson_stats_seed().
+ * stats:   This is a pointer to an initialised amjson_stats structure.
+ */
+unsigned int amjson_stats_ratio(struct amjson_stats *stats);
+
+/* Summary: Start from a previously learned ratio.
+ * stats:   This is a pointer to an initialised amjson_stats structure.
+ * ratio:   This is a value returned by amjson_stats_ratio().
+ */
+void amjson_stats_seed(struct amjson_stats *stats, unsigned int ratio);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
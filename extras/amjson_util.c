@@ -28,6 +28,22 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "amjson.h"
 #include "extras/amjson_util.h"
 
+/* -------------------------------------------------------------------- */
+
+extern struct jindex *jindex_find(struct jhandle *jhandle, 
+				  struct jobject *container, joff_t uses);
+extern uint32_t jindex_keyhash(char *ptr, jsize_t len);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static struct jobject *object_scan(struct jhandle *jhandle,
+				   struct jobject *object,
+				   char *key, jsize_t len);
+static struct jobject *object_probe(struct jhandle *jhandle,
+				    struct jindex *entry,
+				    char *key, jsize_t len, uint32_t hash);
+
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
 struct jobject *amjson_array_index(struct jhandle *jhandle,
@@ -36,6 +52,14 @@ struct jobject *amjson_array_index(struct jhandle *jhandle,
 
   if (index >= ARRAY_COUNT(array)) return (struct jobject *)0;
 
+  /* Long arrays are indexed on first use, later lookups are direct */
+  if ((index > 0) && (ARRAY_COUNT(array) >= AMJSON_INDEXMIN)) {
+
+    struct jindex *entry = jindex_find(jhandle, array, 0);
+
+    if (entry) return JOBJECT_AT(jhandle, entry->offset[index]);
+  }
+
   next = array->u.object.child;
   while (index--) {
     struct jobject *jobject = JOBJECT_AT(jhandle, next);
@@ -47,22 +71,18 @@ struct jobject *amjson_array_index(struct jhandle *jhandle,
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
-struct jobject *amjson_object_find(struct jhandle *jhandle,
+static struct jobject *object_scan(struct jhandle *jhandle,
 				   struct jobject *object,
-				   char *key,
-				   jsize_t len) {
+				   char *key, jsize_t len) {
   joff_t next;
 
-  if (OBJECT_COUNT(object) == 0) return (struct jobject *)0;
-
   next = object->u.object.child;
   do {
 
     struct jobject *jobject = JOBJECT_AT(jhandle, next);
 
     if ((JOBJECT_STRING_LEN(jobject) == len) &&
-	(memcmp(&jhandle->buf[jobject->u.string.offset],
-		key, len) == 0)) {
+	(memcmp(JOBJECT_STRING_PTR(jhandle, jobject), key, len) == 0)) {
       return JOBJECT_AT(jhandle, jobject->next);
     }
 
@@ -73,3 +93,118 @@ struct jobject *amjson_object_find(struct jhandle *jhandle,
   
   return (struct jobject *)0;
 }
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jobject *object_probe(struct jhandle *jhandle,
+				    struct jindex *entry,
+				    char *key, jsize_t len, uint32_t hash) {
+
+  joff_t mask = entry->size - 1;
+  joff_t slot = hash & mask;
+
+  for (; entry->offset[slot] != JOFF_MAX; slot = (slot + 1) & mask) {
+
+    struct jobject *jobject = JOBJECT_AT(jhandle, entry->offset[slot]);
+
+    if ((JOBJECT_STRING_LEN(jobject) == len) &&
+	(memcmp(JOBJECT_STRING_PTR(jhandle, jobject), key, len) == 0)) {
+      return JOBJECT_AT(jhandle, jobject->next);
+    }
+  }
+
+  return (struct jobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_object_find(struct jhandle *jhandle,
+				   struct jobject *object,
+				   char *key,
+				   jsize_t len) {
+
+  if (OBJECT_COUNT(object) == 0) return (struct jobject *)0;
+
+  /* Large objects that are looked up often are hashed by key */
+  if (OBJECT_COUNT(object) >= AMJSON_INDEXMIN) {
+
+    struct jindex *entry = jindex_find(jhandle, object, AMJSON_INDEXUSES);
+
+    if (entry) {
+      return object_probe(jhandle, entry, key, len, 
+			  jindex_keyhash(key, len));
+    }
+  }
+
+  return object_scan(jhandle, object, key, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+struct jobject *amjson_object_find_hash(struct jhandle *jhandle,
+					struct jobject *object,
+					char *key,
+					jsize_t len,
+					uint32_t hash) {
+
+  if (OBJECT_COUNT(object) == 0) return (struct jobject *)0;
+
+  if (OBJECT_COUNT(object) >= AMJSON_INDEXMIN) {
+
+    struct jindex *entry = jindex_find(jhandle, object, AMJSON_INDEXUSES);
+
+    if (entry) return object_probe(jhandle, entry, key, len, hash);
+  }
+
+  return object_scan(jhandle, object, key, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+uint32_t amjson_key_hash(char *key, jsize_t len) {
+
+  return jindex_keyhash(key, len);
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int amjson_equal(struct jhandle *jhandle, struct jobject *a, 
+		 struct jobject *b) {
+
+  unsigned int type = a->blen >> AMJSON_LENBITS;
+  joff_t na;
+  joff_t nb;
+
+  if (a == b) return 1;
+  if (type != (unsigned int)(b->blen >> AMJSON_LENBITS)) return 0;
+
+  if ((type == AMJSON_STRING) || (type == AMJSON_NUMBER)) {
+    return ((JOBJECT_STRING_LEN(a) == JOBJECT_STRING_LEN(b)) &&
+	    (memcmp(JOBJECT_STRING_PTR(jhandle, a), 
+		    JOBJECT_STRING_PTR(jhandle, b),
+		    JOBJECT_STRING_LEN(a)) == 0));
+  }
+
+  /* Containers sharing a list, as left by amjson_dedupe(), are equal
+   * without looking any further. This also covers true, false and null.
+   */
+  if (a->blen != b->blen) return 0;
+  if (a->u.object.child == b->u.object.child) return 1;
+  if (OBJECT_COUNT(a) == 0) return 0;
+
+  na = a->u.object.child;
+  nb = b->u.object.child;
+  do {
+
+    struct jobject *ca = JOBJECT_AT(jhandle, na);
+    struct jobject *cb = JOBJECT_AT(jhandle, nb);
+
+    if (!amjson_equal(jhandle, ca, cb)) return 0;
+
+    na = ca->next;
+    nb = cb->next;
+
+  } while (na != AMJSON_INVALID);
+
+  return 1;
+}
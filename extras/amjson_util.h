@@ -38,6 +38,9 @@ extern "C" {
 
 struct jobject *amjson_array_index(struct jhandle *jhandle, struct jobject *array, joff_t index);
 struct jobject *amjson_object_find(struct jhandle *jhandle, struct jobject *object, char *key, jsize_t len);
+struct jobject *amjson_object_find_hash(struct jhandle *jhandle, struct jobject *object, char *key, jsize_t len, uint32_t hash);
+uint32_t amjson_key_hash(char *key, jsize_t len);
+int amjson_equal(struct jhandle *jhandle, struct jobject *a, struct jobject *b);
 
 /* -------------------------------------------------------------------- */
 /* -------------------------------------------------------------------- */
@@ -0,0 +1,230 @@
+/* -------------------------------------------------------------------- *
+
+Copyright 2019 Angelo Masci
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the 
+"Software"), to deal in the Software without restriction, including 
+without limitation the rights to use, copy, modify, merge, publish, 
+distribute, sublicense, and/or sell copies of the Software, and to permit 
+persons to whom the Software is furnished to do so, subject to the 
+following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ * -------------------------------------------------------------------- */
+
+#define _POSIX_C_SOURCE 199309L   /* clock_gettime() */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "amjson.h"
+#include "extras/amjson_util.h"
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+static double now(void);
+static struct jobject *scan_find(struct jhandle *jhandle, 
+				 struct jobject *object, char *key, 
+				 jsize_t len);
+static int check(unsigned long keys);
+static int bench(unsigned long keys);
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static double now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static struct jobject *scan_find(struct jhandle *jhandle, 
+				 struct jobject *object, char *key, 
+				 jsize_t len) {
+
+  /* A lookup without the key index, for comparison */
+  struct jobject *jobject = OBJECT_FIRST_KEY(jhandle, object);
+
+  for (; jobject; jobject = JOBJECT_NEXT(jhandle, 
+					 JOBJECT_NEXT(jhandle, jobject))) {
+
+    if ((JOBJECT_STRING_LEN(jobject) == len) &&
+	(memcmp(JOBJECT_STRING_PTR(jhandle, jobject), key, len) == 0)) {
+      return JOBJECT_NEXT(jhandle, jobject);
+    }
+  }
+  return (struct jobject *)0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int check(unsigned long keys) {
+
+  /* Every key of an object large enough to be indexed must find the 
+   * same value as a scan, including keys that appear twice where the 
+   * first is found. Each key is looked up until the index is built. The
+   * object is preceded by one holding the key it lacks, which must not
+   * be found through the index.
+   */
+  struct jhandle jhandle;
+  struct jobject *object;
+  unsigned long round;
+  unsigned long i;
+  int status = 0;
+  char *buf;
+  char *ptr;
+  char key[32];
+
+  if (!(buf = (char *)malloc(keys * 64 + 64))) return -1;
+
+  ptr = buf;
+  ptr += sprintf(ptr, "[{\"key%lu\":-1},{", keys);
+  for (i=0; i<keys; i++) {
+    ptr += sprintf(ptr, "%s\"key%lu\":%lu", (i)?",":"", i, i);
+  }
+  for (i=0; i<keys; i+=3) {
+    ptr += sprintf(ptr, ",\"key%lu\":%lu", i, keys + i);
+  }
+  ptr += sprintf(ptr, "}]");
+
+  if (amjson_alloc(&jhandle, (struct jobject *)0, 
+		   (joff_t)(keys * 4 + 8)) != 0) {
+    free(buf);
+    return -1;
+  }
+  if (amjson_decode(&jhandle, buf, (bsize_t)(ptr - buf)) != 0) {
+    amjson_free(&jhandle);
+    free(buf);
+    return -1;
+  }
+  object = JOBJECT_NEXT(&jhandle, 
+		       ARRAY_FIRST(&jhandle, JOBJECT_ROOT(&jhandle)));
+
+  for (round=0; (status == 0) && (round<=AMJSON_INDEXUSES+1); round++) {
+    for (i=0; i<=keys; i++) {
+
+      /* The last key is not in the object */
+      sprintf(key, "key%lu", i);
+      if (amjson_object_find(&jhandle, object, key, strlen(key)) !=
+	  scan_find(&jhandle, object, key, strlen(key))) {
+	fprintf(stderr, "Key index lookup of '%s' differs from scan\n", 
+		key);
+	status = -1;
+	break;
+      }
+    }
+  }
+
+  amjson_free(&jhandle);
+  free(buf);
+  return status;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+static int bench(unsigned long keys) {
+
+  /* Look up keys at random in an object of the given size, by scanning 
+   * and with amjson_object_find(). The time for amjson_object_find() 
+   * includes building the key index.
+   */
+  struct jhandle jhandle;
+  struct jobject *object;
+  unsigned long lookups;
+  unsigned long scans;
+  unsigned long i;
+  unsigned long found = 0;
+  char *buf;
+  char *ptr;
+  char key[32];
+  double start;
+  double scan;
+  double find;
+
+  if (!(buf = (char *)malloc(keys * 32 + 2))) return -1;
+
+  ptr = buf;
+  *ptr++ = '{';
+  for (i=0; i<keys; i++) {
+    ptr += sprintf(ptr, "%s\"key%lu\":%lu", (i)?",":"", i, i);
+  }
+  *ptr++ = '}';
+
+  if (amjson_alloc(&jhandle, (struct jobject *)0, 
+		   (joff_t)(keys * 2 + 1)) != 0) {
+    free(buf);
+    return -1;
+  }
+  if (amjson_decode(&jhandle, buf, (bsize_t)(ptr - buf)) != 0) {
+    amjson_free(&jhandle);
+    free(buf);
+    return -1;
+  }
+  object = JOBJECT_ROOT(&jhandle);
+
+  /* Scanning is quadratic so it gets fewer lookups */
+  lookups = 1000000;
+  scans   = 100000000 / keys;
+  if (scans > lookups) scans = lookups;
+  if (scans < 10) scans = 10;
+
+  srand(1);
+  start = now();
+  for (i=0; i<scans; i++) {
+    sprintf(key, "key%lu", (unsigned long)rand() % keys);
+    found += (scan_find(&jhandle, object, key, strlen(key)) != 0);
+  }
+  scan = now() - start;
+
+  srand(1);
+  start = now();
+  for (i=0; i<lookups; i++) {
+    sprintf(key, "key%lu", (unsigned long)rand() % keys);
+    found += (amjson_object_find(&jhandle, object, key, strlen(key)) != 0);
+  }
+  find = now() - start;
+
+  fprintf(stdout, "keys:%-8lu scan ns:%-12.1f find ns:%-8.1f [%lu]\n", 
+	  keys, scan * 1e9 / scans, find * 1e9 / lookups, found);
+
+  amjson_free(&jhandle);
+  free(buf);
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+int main(void) {
+
+  unsigned long keys;
+
+  if ((check(AMJSON_INDEXMIN) != 0) || (check(AMJSON_INDEXMIN * 100) != 0)) {
+    fprintf(stderr, "Failed checking key index\n");
+    return 1;
+  }
+
+  for (keys = 10; keys <= 1000000; keys *= 10) {
+    if (bench(keys) != 0) {
+      fprintf(stderr, "Failed running benchmark\n");
+      return 1;
+    }
+  }
+  return 0;
+}